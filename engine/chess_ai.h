@@ -2,18 +2,149 @@ using namespace std;
 
 #pragma once
 #include "transposition_table.h"
-#include "pst.h"
+#include "move_picker.h"
+#include "repetition_table.h"
+#include "time_manager.h"
+#include "../src/pst.h"
+#include "../src/castling.h"
 #include <limits>
 #include <fstream>
 #include <algorithm>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <new>
+#include <cmath>
+
+// Depth skipping pattern for helper threads (Lazy SMP): helper i skips
+// iterations where ((depth + SKIP_PHASE[i]) / SKIP_SIZE[i]) is odd, so that
+// the helpers spread themselves over different depths instead of all
+// searching the same tree in lockstep with the main thread.
+const int NUM_SKIP_PATTERNS = 20;
+const int SKIP_SIZE[NUM_SKIP_PATTERNS] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+const int SKIP_PHASE[NUM_SKIP_PATTERNS] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+const int DEFAULT_HASH_MB = 16;
+// Time per move when the caller doesn't set any limits
+const int DEFAULT_MOVE_TIME_MS = 1000;
+// Negamax nodes between two clock checks in the main thread
+const int CLOCK_CHECK_INTERVAL = 1024;
+
+// Maximum search ply, including extensions
+const int MAX_PLY = 128;
+static_assert(RepetitionTable::MAX_GAME_KEYS + 1 + MAX_PLY <= RepetitionTable::MAX_SIZE, "Repetition table too small for the search");
+// Search stack entries before the one of the root, so that every ply has
+// the two plies before it
+const int SEARCH_STACK_OFFSET = 2;
+
+// Late move reductions are computed in 1/REDUCTION_SCALE plies, so that the
+// adjustments made in negamaxSearch can add up to fractions of a ply
+const int REDUCTION_SCALE = 1024;
+// Upper bound on the number of legal moves in a position
+const int MAX_MOVES = 256;
+// Base reduction of the n-th move searched at the given depth:
+// LMR_BASE + LMR_FACTOR * log(depth) * log(n)
+const int LMR_BASE = 768;
+const int LMR_FACTOR = 455;
+
+struct ReductionTable {
+    int reductions[MAX_PLY][MAX_MOVES];
+
+    ReductionTable() {
+        for (int depth = 0; depth < MAX_PLY; ++depth) {
+            for (int n = 0; n < MAX_MOVES; ++n) {
+                reductions[depth][n] = depth && n ? int(LMR_BASE + LMR_FACTOR * log(depth) * log(n)) : 0;
+            }
+        }
+    }
+
+    int operator()(int depth, int n) const {
+        return reductions[min(depth, MAX_PLY - 1)][min(n, MAX_MOVES - 1)];
+    }
+};
+
+inline const ReductionTable REDUCTIONS;
+
+enum NodeType { NON_PV, PV, ROOT };
+
+// surge positions can't be assigned, and Position::set expects a freshly
+// constructed position, so positions that a ChessAI holds a reference to are
+// rebuilt in place instead
+inline void rebuildPosition(Position& position, const Position& source) {
+    position.~Position();
+    new (&position) Position(source);
+}
+
+inline void rebuildPosition(Position& position, const string& fen) {
+    position.~Position();
+    new (&position) Position();
+    Position::set(fen, position);
+    dropStaleCastlingRights(position);
+}
+
+// Summary of a completed iteration, reported to the front end
+struct SearchInfo {
+    int depth;
+    int selectiveDepth;
+    int score;
+    // Whether score is a mate score, and then the moves to mate, negative
+    // or 0 when getting mated
+    bool isMate;
+    int mateIn;
+    uint64_t nodes;
+    int64_t timeMs;
+    vector<Move> pv;
+};
+
+// Per-ply state of the line being searched
+struct SearchStackEntry {
+    // The move played from this ply and the piece that made it, Move() and
+    // NO_PIECE for a null move
+    Move move;
+    Piece movedPiece;
+    // Continuation history of the move, the sentinel entry for a null move
+    PieceToHistory* continuationHistory;
+    // Static evaluation of the position, EVAL_NONE when in check
+    int staticEval;
+    // Move skipped by the singular extension search of this ply
+    Move excludedMove;
+};
 
 class ChessAI {
     private:
         Position& position;
         PST tables;
-        TranspositionTable transpositionTable;
+        PsqtState psqtState;
+        shared_ptr<TranspositionTable> sharedTable;
+        TranspositionTable& transpositionTable;
         Move killerMoves[64][2];
+        // Too big to go on the stack with the rest of the engine context
+        unique_ptr<MoveHistory> moveHistory = make_unique<MoveHistory>();
+        SearchStackEntry searchStack[MAX_PLY + SEARCH_STACK_OFFSET];
+        RepetitionTable repetitionTable;
+        vector<uint64_t> gameHistory;
+
+        // Lazy SMP: thread 0 is the main thread and owns the stop flag,
+        // helpers search their own copy of the position and share the table
+        int threadId = 0;
+        int numThreads = 1;
+        atomic<bool> stopFlag{false};
+        atomic<bool>& stopSearch;
+        bool searchAborted = false;
+        int completedDepth = 0;
+        SearchLimits limits;
+        TimeManager timeManager;
+        // Only written by its own thread, but the main thread reads the
+        // helpers' counts to report the total
+        atomic<uint64_t> nodes{0};
+        uint64_t nextClockCheck = 0;
+        // Helper threads and their copies of the position are kept between
+        // searches, so that their move ordering tables stay warm too
+        vector<unique_ptr<Position>> helperPositions;
+        vector<unique_ptr<ChessAI>> helpers;
+        function<void(const SearchInfo&)> infoCallback;
 
         int numNegamaxSearches = 0;
         int numQuiescenceSearches = 0;
@@ -27,15 +158,177 @@ class ChessAI {
         vector<pair<Move, int>> candidateMoves;
         Move bestMoveThisIteration;
 
-        const int CHECKMATE_SCORE = 64000;
+        // Triangular PV table: row ply holds the best line found from that
+        // ply, pvTable[ply][ply] to pvTable[ply][pvLength[ply] - 1]
+        Move pvTable[MAX_PLY][MAX_PLY];
+        int pvLength[MAX_PLY];
+        // PV of the last finished iteration, searched first in the next one
+        Move previousPv[MAX_PLY];
+        int previousPvLength = 0;
+        bool followPv = false;
+        // While a null move cutoff is verified, nullMoveColor doesn't try
+        // null moves before ply nullMoveMinPly
+        int nullMoveMinPly = 0;
+        Color nullMoveColor = WHITE;
+
+        // Scores are stored as int16 in the transposition table
+        const int CHECKMATE_SCORE = 32000;
+        const int MAX_MATE_PLY = 256;
         const int MAX_NUM_EXTENSIONS = 16;
-        const int FUTILITY_MARGIN = 300;
-        int midgamePieceValues[14] = {82, 337, 365, 477, 1025, 0, 0, 0, -82, -337, -365, -477, -1025, 0};
-        int endgamePieceValues[14] = {94, 281, 297, 512, 936, 0, 0, 0, -94, -281, -297, -512, -936, 0};
-        int gamePhaseIncrement[14] = {0, 1, 1, 2, 4, 0, 0, 0, 0, 1, 1, 2, 4, 0};
+        // Singular extensions from depth SE_MIN_DEPTH on, for a TT move whose
+        // lower bound was searched to at most SE_TT_DEPTH_MARGIN plies less.
+        // The other moves must stay SE_MARGIN per ply of depth below it.
+        const int SE_MIN_DEPTH = 7;
+        const int SE_TT_DEPTH_MARGIN = 3;
+        const int SE_MARGIN = 2;
+        // Pruning before the move loop, in non-PV nodes out of check:
+        // reverse futility pruning up to RFP_MAX_DEPTH when the evaluation
+        // is RFP_MARGIN per ply of depth (one ply less when improving) above
+        // beta, and razoring up to RAZOR_MAX_DEPTH when it is RAZOR_MARGIN
+        // per ply below alpha
+        const int RFP_MAX_DEPTH = 6;
+        const int RFP_MARGIN = 80;
+        const int RAZOR_MAX_DEPTH = 2;
+        const int RAZOR_MARGIN = 300;
+        // Null move reduction is NMP_BASE_REDUCTION + depth / NMP_DEPTH_DIVISOR
+        // plus a ply per NMP_EVAL_DIVISOR the evaluation is above beta, up to
+        // NMP_MAX_EVAL_REDUCTION. From NMP_VERIFICATION_DEPTH on a null move
+        // cutoff is verified by a search without null moves.
+        const int NMP_MIN_DEPTH = 3;
+        const int NMP_BASE_REDUCTION = 3;
+        const int NMP_DEPTH_DIVISOR = 3;
+        const int NMP_EVAL_DIVISOR = 200;
+        const int NMP_MAX_EVAL_REDUCTION = 3;
+        const int NMP_VERIFICATION_DEPTH = 12;
+        // ProbCut from depth PROBCUT_MIN_DEPTH on, with captures that beat
+        // beta + PROBCUT_MARGIN in a search PROBCUT_DEPTH_REDUCTION plies
+        // shallower
+        const int PROBCUT_MIN_DEPTH = 5;
+        const int PROBCUT_MARGIN = 100;
+        const int PROBCUT_DEPTH_REDUCTION = 4;
+        // Pruning of quiet moves in the move loop: late move pruning up to
+        // LMP_MAX_DEPTH after LMP_BASE + depth^2 moves, half as many more
+        // when improving, and futility pruning up to FUTILITY_MAX_DEPTH when
+        // the evaluation is FUTILITY_BASE + FUTILITY_MARGIN per ply below alpha
+        const int LMP_MAX_DEPTH = 6;
+        const int LMP_BASE = 3;
+        const int FUTILITY_MAX_DEPTH = 6;
+        const int FUTILITY_BASE = 100;
+        const int FUTILITY_MARGIN = 150;
+        // Late move reductions apply to quiet moves after the first
+        // LMR_MIN_MOVE moves at depth LMR_MIN_DEPTH or more. The
+        // adjustments to the table's reduction are in 1/REDUCTION_SCALE plies:
+        // less in PV nodes, more when the static evaluation hasn't improved
+        // over the last two plies, more when the TT move is a capture, and
+        // history score / LMR_HISTORY_DIVISOR less.
+        const int LMR_MIN_DEPTH = 3;
+        const int LMR_MIN_MOVE = 2;
+        const int LMR_PV_NODE = 1024;
+        const int LMR_NOT_IMPROVING = 1024;
+        const int LMR_TT_CAPTURE = 1024;
+        const int LMR_HISTORY_DIVISOR = 16;
+        // History bonus of a cutoff at the given depth is
+        // min(HISTORY_BONUS_SLOPE * depth - HISTORY_BONUS_OFFSET, HISTORY_BONUS_MAX)
+        const int HISTORY_BONUS_SLOPE = 200;
+        const int HISTORY_BONUS_OFFSET = 150;
+        const int HISTORY_BONUS_MAX = 1600;
+        // Moves searched before a cutoff that are remembered for the maluses
+        static const int MAX_SEARCHED_MOVES = 64;
         int PIECE_VALUES[14] = {100, 300, 300, 500, 900, 0, 0, 0, -100, -300, -300, -500, -900, 0};
     public:
-        ChessAI(Position& p) : position(p), transpositionTable(1048576) {}
+        ChessAI(Position& p) : position(p), sharedTable(make_shared<TranspositionTable>(DEFAULT_HASH_MB)), transpositionTable(*sharedTable), stopSearch(stopFlag) {
+            limits.moveTime = DEFAULT_MOVE_TIME_MS;
+        }
+        ChessAI(Position& p, ChessAI& mainThread, int id) :
+            position(p), sharedTable(mainThread.sharedTable), transpositionTable(*sharedTable), repetitionTable(mainThread.repetitionTable), threadId(id), stopSearch(mainThread.stopFlag) {}
+
+        void setThreads(int threads) {
+            numThreads = max(1, threads);
+        }
+
+        void setLimits(const SearchLimits& searchLimits) {
+            limits = searchLimits;
+        }
+
+        // Called by the main thread after every completed iteration
+        void setInfoCallback(function<void(const SearchInfo&)> callback) {
+            infoCallback = callback;
+        }
+
+        void setHashSize(int mbSize) {
+            transpositionTable.resize(max(1, mbSize));
+        }
+
+        // Forgets everything learned from the previous game. Between moves
+        // of the same game the table is only aged, see newSearch.
+        void newGame() {
+            transpositionTable.clear();
+            clearOrdering();
+            for (unique_ptr<ChessAI>& helper : helpers) {
+                helper->clearOrdering();
+            }
+        }
+
+        void clearOrdering() {
+            moveHistory->clear();
+            for (int i = 0; i < 64; ++i) {
+                killerMoves[i][0] = Move();
+                killerMoves[i][1] = Move();
+            }
+        }
+
+        // Moves the killers along when the game has advanced by the given
+        // number of plies since the last search, so that the killers of
+        // ply n + plies become the killers of ply n
+        void advanceRoot(int plies) {
+            if (plies <= 0) {
+                return;
+            }
+            for (int i = 0; i < 64; ++i) {
+                killerMoves[i][0] = i + plies < 64 ? killerMoves[i + plies][0] : Move();
+                killerMoves[i][1] = i + plies < 64 ? killerMoves[i + plies][1] : Move();
+            }
+            for (unique_ptr<ChessAI>& helper : helpers) {
+                helper->advanceRoot(plies);
+            }
+        }
+
+        // Asks a running search to stop. It returns the result of the last
+        // completed iteration, and always completes depth 1.
+        void stop() {
+            stopSearch = true;
+        }
+
+        // Has to be called before starting a search with lazySmpSearch, from
+        // the thread that may later call stop
+        void resetStop() {
+            stopSearch = false;
+        }
+
+        // Keys (see positionKey) of the game positions before the current
+        // one, oldest first, starting at the position after the last capture
+        // or pawn move. Without them the search can only see repetitions
+        // that happen within its own tree.
+        void setGameHistory(const vector<uint64_t>& keys) {
+            gameHistory = keys;
+        }
+
+        Move getBestMove() const {
+            return bestMovePerIteration.back();
+        }
+
+        int getEvaluation() const {
+            return evaluationPerIteration.back();
+        }
+
+        int getCompletedDepth() const {
+            return completedDepth;
+        }
+
+        vector<Move> getPrincipalVariation() const {
+            return vector<Move>(previousPv, previousPv + previousPvLength);
+        }
+
         void printDebug() {
             cout << "Negamax searches: " << numNegamaxSearches;
             cout << " | Quiscence searches: " << numQuiescenceSearches;
@@ -51,46 +344,136 @@ class ChessAI {
 
 
         template<Color Us>
-        vector<pair<int, Move>> orderMoves(MoveList<Us>& legalMoves, int ply, bool filterCaptures) {
-            vector<pair<int, Move>> orderedMoves;
-            for (Move move : legalMoves) {
-                int moveScore = 0;
-                if (ply == 0 && !bestMovePerIteration.empty() && bestMovePerIteration[bestMovePerIteration.size() - 1] == move) {
-                    moveScore += 10000;
-                }
-
-                if (move.is_capture()) {
-                    Piece from = position.at(move.from());
-                    Piece to = position.at(move.to());
-//                    moveScore += 10 * abs(PIECE_VALUES[to]) - abs(PIECE_VALUES[from]);
-                    moveScore += 10 * abs(midgamePieceValues[to]) - abs(midgamePieceValues[from]);
-                    orderedMoves.push_back({moveScore, move});
-                } else if (!filterCaptures) {
-                    if ((pawn_attacks<~Us>(position.bitboard_of(~Us, PAWN)) & SQUARE_BB[move.to()]) > 0) {
-                        moveScore -= 100;
-                    }
-                    if (killerMoves[ply][0] == move || killerMoves[ply][1] == move) {
-                        moveScore += 1000;
-                    }
-                    orderedMoves.push_back({moveScore, move});
+        inline uint64_t hashKey() const {
+            if constexpr (Us == BLACK) {
+                return position.get_hash() ^ BLACK_TO_MOVE_KEY;
+            }
+            return position.get_hash();
+        }
+
+        // Mate scores are stored relative to the node rather than the root,
+        // so that they stay correct when the position is reached at another ply
+        inline int scoreToTT(int score, int ply) const {
+            if (score >= CHECKMATE_SCORE - MAX_MATE_PLY) {
+                return score + ply;
+            }
+            if (score <= -CHECKMATE_SCORE + MAX_MATE_PLY) {
+                return score - ply;
+            }
+            return score;
+        }
+
+        inline int scoreFromTT(int score, int ply) const {
+            if (score >= CHECKMATE_SCORE - MAX_MATE_PLY) {
+                return score - ply;
+            }
+            if (score <= -CHECKMATE_SCORE + MAX_MATE_PLY) {
+                return score + ply;
+            }
+            return score;
+        }
+
+        inline int historyBonus(int depth) const {
+            return min(HISTORY_BONUS_SLOPE * depth - HISTORY_BONUS_OFFSET, HISTORY_BONUS_MAX);
+        }
+
+        // Updates the butterfly history and the continuation histories of
+        // the two previous moves for a quiet move at the ply of ss
+        template<Color Us>
+        inline void updateQuietHistory(const SearchStackEntry* ss, Move move, int bonus) {
+            Piece moving = position.at(move.from());
+            updateHistoryEntry(moveHistory->butterfly[Us][move.from()][move.to()], bonus);
+            for (int i = 1; i <= 2; ++i) {
+                if ((ss - i)->move != Move()) {
+                    updateHistoryEntry((*(ss - i)->continuationHistory)[moving][move.to()], bonus);
                 }
             }
-            sort(orderedMoves.begin(), orderedMoves.end(), [](const auto& a, const auto& b)
-            {
-                return a.first > b.first;
-            });
-            return orderedMoves;
-   
         }
 
+        inline void updateCaptureHistory(Move move, int bonus) {
+            updateHistoryEntry(moveHistory->capture[position.at(move.from())][move.to()][capturedType(position, move)], bonus);
+        }
+
+        // Rewards the move that caused a beta cutoff, and punishes the moves
+        // searched before it that didn't: the quiet ones if it is quiet, and
+        // the captures either way
         template<Color Us>
+        void updateCutoffStats(const SearchStackEntry* ss, int ply, int depth, Move move,
+                               const Move* quiets, int numQuiets, const Move* captures, int numCaptures) {
+            int bonus = historyBonus(depth);
+            if (!isTactical(move)) {
+                if (ply < 64 && killerMoves[ply][0] != move) {
+                    killerMoves[ply][1] = killerMoves[ply][0];
+                    killerMoves[ply][0] = move;
+                }
+                if ((ss - 1)->move != Move()) {
+                    moveHistory->counterMoves[(ss - 1)->movedPiece][(ss - 1)->move.to()] = move;
+                }
+                updateQuietHistory<Us>(ss, move, bonus);
+                for (int i = 0; i < numQuiets; ++i) {
+                    updateQuietHistory<Us>(ss, quiets[i], -bonus);
+                }
+            } else {
+                updateCaptureHistory(move, bonus);
+            }
+            for (int i = 0; i < numCaptures; ++i) {
+                updateCaptureHistory(captures[i], -bonus);
+            }
+        }
+
+        // Makes move followed by the child's PV the PV of this ply
+        inline void updatePv(int ply, Move move) {
+            pvTable[ply][ply] = move;
+            for (int i = ply + 1; i < pvLength[ply + 1]; ++i) {
+                pvTable[ply][i] = pvTable[ply + 1][i];
+            }
+            pvLength[ply] = max(pvLength[ply + 1], ply + 1);
+        }
+
+        // Principal variation search: the first move of a PV node is searched
+        // with the full window, every other move with a zero window around
+        // alpha and only re-searched with the full window if it beats alpha.
+        // The node type is a template parameter so that non-PV nodes compile
+        // without the PV bookkeeping.
+        template<Color Us, NodeType Node>
         int negamaxSearch(int ply, int depth, int alpha, int beta, int numExtensions) {
+            constexpr bool pvNode = Node != NON_PV;
+            constexpr bool rootNode = Node == ROOT;
+            // Only the main thread looks at the clock, and only once it has
+            // a completed iteration to fall back on
+            uint64_t searched = nodes.load(memory_order_relaxed) + 1;
+            nodes.store(searched, memory_order_relaxed);
+            if (searched >= nextClockCheck && threadId == 0 && completedDepth > 0) {
+                nextClockCheck = searched + CLOCK_CHECK_INTERVAL;
+                if (timeManager.hardLimitReached()) {
+                    stopSearch = true;
+                }
+            }
+            if (stopSearch.load(memory_order_relaxed) && (threadId != 0 || completedDepth > 0)) {
+                searchAborted = true;
+                return 0;
+            }
+            if constexpr (pvNode) {
+                pvLength[ply] = ply;
+            }
             if (ply > maxDepthSearched) {
                 maxDepthSearched = ply;
             }
-            if (ply > 0) {
-                // TODO: implement repetition table
-                // if (repetitionTable.contains(position.get_hash())) { return 0 };
+            if (ply >= MAX_PLY - 1) {
+                return evaluate<Us>();
+            }
+            if constexpr (!rootNode) {
+                if (repetitionTable.isRepetition()) {
+                    return 0;
+                }
+                // If we can repeat a position from the search line, we can
+                // at least draw
+                if (alpha < 0 && repetitionTable.hasUpcomingRepetition(ply, position.all_pieces<Us>() | position.all_pieces<~Us>())) {
+                    alpha = 0;
+                    if (alpha >= beta) {
+                        return alpha;
+                    }
+                }
             }
             alpha = max(alpha, -CHECKMATE_SCORE + ply);
             beta = min(beta, CHECKMATE_SCORE - ply);
@@ -98,141 +481,350 @@ class ChessAI {
                 return alpha;
             }
 
-            TTEntry* entry = transpositionTable.probe(position.get_hash());
-            if (entry != nullptr && entry->depth >= depth) {
+            uint64_t positionHash = hashKey<Us>();
+            TTData entry;
+            bool ttHit = transpositionTable.probe(positionHash, entry);
+            SearchStackEntry* ss = &searchStack[ply + SEARCH_STACK_OFFSET];
+            // A search that excludes a move doesn't search the same tree as
+            // the stored result, so it neither uses nor stores table scores
+            Move excludedMove = ss->excludedMove;
+            // PV nodes don't take cutoffs from the table, so that the PV
+            // reaches the full depth
+            if (!pvNode && excludedMove == Move() && ttHit && entry.depth >= depth) {
                 ++numTranspositionTableHits;
-                int storedEval = entry->eval;
-                int bound = entry->bound;
+                int storedEval = scoreFromTT(entry.eval, ply);
+                int bound = entry.bound;
                 if (bound == EXACT) {
-                    if constexpr (Us == WHITE) {
-                        return -storedEval;
-                    } else {
-                        return storedEval;
-                    }
+                    return storedEval;
             //    } else if (bound == UPPER_BOUND && storedEval <= alpha) {
-            //         if constexpr (Us == WHITE) {
-            //             return -storedEval;
-            //         } else {
-            //             return storedEval;
-            //         }
+            //         return storedEval;
                 } else if (bound == LOWER_BOUND && storedEval >= beta) {
                     return storedEval;
                 }
             }
 
-            if (depth == 0) {
+            if (depth <= 0) {
                 return quiescenceSearch<Us>(alpha, beta);
             }
 
             ++numNegamaxSearches;
-            
-
 
-            MoveList<Us> legalMoves(position);
-            if (legalMoves.size() == 0) {
-                if (position.in_check<Us>()) { // Checkmate
-                    return -(CHECKMATE_SCORE - ply);
-                } else { // Stalemate
-                    return 0;
-                }
+            Move ttMove = ttHit ? entry.bestMove : Move();
+            // Follow the PV of the previous iteration for as long as we are
+            // on it
+            bool onPreviousPv = pvNode && followPv && ply < previousPvLength;
+            if (onPreviousPv) {
+                ttMove = previousPv[ply];
             }
-            if (ply > 0) {
-                // TODO: add repetition table logic
-                // repetitionTable.store(position.get_hash(), prevWasCapture, prevWasPawnMove);
+            followPv = false;
+            bool isInCheck = position.in_check<Us>();
+            // Static evaluation, computed once per node and stored in the
+            // table with the search result. Where its bound allows, a stored
+            // search result is the better estimate for the pruning below.
+            int staticEval = EVAL_NONE;
+            int evalScore = 0;
+            if (!isInCheck) {
+                staticEval = ttHit && entry.staticEval != EVAL_NONE ? entry.staticEval : evaluate<Us>();
+                evalScore = staticEval;
+                if (ttHit) {
+                    int storedEval = scoreFromTT(entry.eval, ply);
+                    if (entry.bound == EXACT || (entry.bound == LOWER_BOUND ? storedEval > evalScore : storedEval < evalScore)) {
+                        evalScore = storedEval;
+                    }
+                }
             }
+            ss->staticEval = staticEval;
+            // Whether the static evaluation went up since our previous move
+            bool improving = !isInCheck && ((ss - 2)->staticEval == EVAL_NONE || staticEval > (ss - 2)->staticEval);
 
-            // Null move pruning
-            bool isInCheck = position.in_check<Us>();
-            if (!isInCheck && depth >= 3) {
-                Square emptySquare = static_cast<Square>(__builtin_ctzll(~(position.all_pieces<Us>() | position.all_pieces<~Us>())));
-                Move nullMove = Move(emptySquare, emptySquare);
-                position.play<Us>(nullMove);
-                int R = 2;
-                int score = -negamaxSearch<~Us>(ply + 1, depth - 1 - R, -beta, -beta + 1, 0);
-                position.undo<Us>(nullMove);
-                if (score >= beta) {
+            if (!pvNode && !isInCheck && excludedMove == Move()) {
+                // Reverse futility pruning
+                // So far above beta that no move of the opponent is likely
+                // to bring the score back down
+                if (depth <= RFP_MAX_DEPTH && evalScore - RFP_MARGIN * (depth - improving) >= beta
+                    && evalScore < CHECKMATE_SCORE - MAX_MATE_PLY) {
                     return beta;
                 }
+
+                // Razoring
+                // So far below alpha that only captures can help, so let
+                // the quiescence search decide
+                if (depth <= RAZOR_MAX_DEPTH && evalScore + RAZOR_MARGIN * depth <= alpha) {
+                    int score = quiescenceSearch<Us>(alpha, beta);
+                    if (score <= alpha) {
+                        return alpha;
+                    }
+                }
+
+                // Null move pruning
+                // Skipped after a null move, without pieces to avoid zugzwang,
+                // and for the side whose null move is being verified
+                Bitboard pieces = position.bitboard_of(Us, KNIGHT) | position.bitboard_of(Us, BISHOP)
+                                | position.bitboard_of(Us, ROOK) | position.bitboard_of(Us, QUEEN);
+                if (depth >= NMP_MIN_DEPTH && evalScore >= beta && (ss - 1)->move != Move() && pieces
+                    && (ply >= nullMoveMinPly || Us != nullMoveColor)) {
+                    int R = NMP_BASE_REDUCTION + depth / NMP_DEPTH_DIVISOR + min((evalScore - beta) / NMP_EVAL_DIVISOR, NMP_MAX_EVAL_REDUCTION);
+                    int nullMoveDepth = max(depth - 1 - R, 0);
+                    Square emptySquare = static_cast<Square>(__builtin_ctzll(~(position.all_pieces<Us>() | position.all_pieces<~Us>())));
+                    Move nullMove = Move(emptySquare, emptySquare);
+                    ss->move = Move();
+                    ss->movedPiece = NO_PIECE;
+                    ss->continuationHistory = &moveHistory->continuation[NO_PIECE][0];
+                    position.play<Us>(nullMove);
+                    transpositionTable.prefetch(hashKey<~Us>());
+                    // Positions before a null move can't be repeated after it
+                    repetitionTable.push(hashKey<~Us>(), true);
+                    int score = -negamaxSearch<~Us, NON_PV>(ply + 1, nullMoveDepth, -beta, -beta + 1, 0);
+                    repetitionTable.pop();
+                    position.undo<Us>(nullMove);
+                    if (searchAborted) {
+                        return 0;
+                    }
+                    if (score >= beta) {
+                        if (depth < NMP_VERIFICATION_DEPTH || nullMoveMinPly > 0) {
+                            return beta;
+                        }
+                        // At high depth, confirm with a search of this node
+                        // at the same depth in which we don't null move
+                        // for the next plies
+                        nullMoveMinPly = ply + 3 * nullMoveDepth / 4;
+                        nullMoveColor = Us;
+                        score = negamaxSearch<Us, NON_PV>(ply, nullMoveDepth, beta - 1, beta, numExtensions);
+                        nullMoveMinPly = 0;
+                        if (searchAborted) {
+                            return 0;
+                        }
+                        if (score >= beta) {
+                            return beta;
+                        }
+                    }
+                }
+
+                // ProbCut
+                // If a good capture beats beta by a margin in a quiescence
+                // search and then in a search at reduced depth, the full
+                // depth search is very likely to fail high too. Skipped when
+                // the table already says that it won't beat the margin.
+                int probCutBeta = beta + PROBCUT_MARGIN;
+                if (depth >= PROBCUT_MIN_DEPTH && abs(beta) < CHECKMATE_SCORE - MAX_MATE_PLY
+                    && !(ttHit && entry.depth >= depth - PROBCUT_DEPTH_REDUCTION + 1 && scoreFromTT(entry.eval, ply) < probCutBeta)) {
+                    MovePicker<Us> probCutPicker(position, ttMove, *moveHistory);
+                    for (Move move = probCutPicker.nextMove(); move != Move(); move = probCutPicker.nextMove()) {
+                        // SEE counts promotions as 0, so they are credited
+                        // with the capture and the promotion here
+                        int threshold = probCutBeta - staticEval;
+                        if (move.flags() == PR_QUEEN || move.flags() == PC_QUEEN) {
+                            threshold -= PIECE_TYPE_VALUES[capturedType(position, move)] + PIECE_TYPE_VALUES[QUEEN] - PIECE_TYPE_VALUES[PAWN];
+                        }
+                        if (!seeGE<Us>(position, move, threshold)) {
+                            continue;
+                        }
+                        ss->move = move;
+                        ss->movedPiece = position.at(move.from());
+                        ss->continuationHistory = &moveHistory->continuation[ss->movedPiece][move.to()];
+                        PsqtState previousPsqtState = psqtState;
+                        updatePsqtState<Us>(move);
+                        position.play<Us>(move);
+                        transpositionTable.prefetch(hashKey<~Us>());
+                        repetitionTable.push(hashKey<~Us>(), true);
+                        int score = -quiescenceSearch<~Us>(-probCutBeta, -probCutBeta + 1);
+                        if (score >= probCutBeta) {
+                            score = -negamaxSearch<~Us, NON_PV>(ply + 1, depth - PROBCUT_DEPTH_REDUCTION, -probCutBeta, -probCutBeta + 1, numExtensions);
+                        }
+                        repetitionTable.pop();
+                        position.undo<Us>(move);
+                        psqtState = previousPsqtState;
+                        if (searchAborted) {
+                            return 0;
+                        }
+                        if (score >= probCutBeta) {
+                            transpositionTable.store(positionHash, depth - PROBCUT_DEPTH_REDUCTION + 1, scoreToTT(probCutBeta, ply), LOWER_BOUND, move, staticEval);
+                            return beta;
+                        }
+                    }
+                }
+            }
+
+            // Moves are only generated once the node survived the pruning
+            // above, which makes it miss stalemates that it prunes
+            const PieceToHistory* continuationHistories[2] = {(ss - 1)->continuationHistory, (ss - 2)->continuationHistory};
+            Move counterMove = (ss - 1)->move != Move() ? moveHistory->counterMoves[(ss - 1)->movedPiece][(ss - 1)->move.to()] : Move();
+            MovePicker<Us> movePicker(position, ttMove, ply < 64 ? killerMoves[ply] : nullptr, counterMove, *moveHistory, continuationHistories);
+            if (movePicker.size() == 0) {
+                if (isInCheck) { // Checkmate
+                    return -(CHECKMATE_SCORE - ply);
+                } else { // Stalemate
+                    return 0;
+                }
             }
 
             Bound evaluationBound = UPPER_BOUND;
-            vector<pair<int, Move>> orderedMoves = orderMoves<Us>(legalMoves, ply, false);
-            // bool isInCheck;
-            int evalScore;
-            if (depth == 1) {
-                // isInCheck = position.in_check<Us>();    
-                evalScore = evaluate<Us>();
-            }
-            Move bestMove = orderedMoves[0].second;
-            for (int i = 0; i < orderedMoves.size(); ++i) {
-                Move move = orderedMoves[i].second;
-
-                // Futility Pruning
-                if (depth >= 2 && !isInCheck && !move.is_capture() && evalScore + FUTILITY_MARGIN * depth <= alpha) {
+            bool ttCapture = ttMove != Move() && isTactical(ttMove);
+            Move bestMove;
+            Move quietsSearched[MAX_SEARCHED_MOVES];
+            Move capturesSearched[MAX_SEARCHED_MOVES];
+            int numQuiets = 0, numCaptures = 0;
+            // Moves picked so far, this one included. The excluded move of a
+            // singular search doesn't count, so the first real move is
+            // still treated as the first.
+            int moveCount = 0;
+            for (Move move = movePicker.nextMove(); move != Move(); move = movePicker.nextMove()) {
+                if (move == excludedMove) {
                     continue;
                 }
+                ++moveCount;
+                if (moveCount == 1) {
+                    bestMove = move;
+                }
+
+                // Quiet moves that are unlikely to raise alpha are pruned once
+                // a move has been searched, unless we are getting mated
+                if (!rootNode && !isInCheck && moveCount > 1 && !isTactical(move) && alpha > -CHECKMATE_SCORE + MAX_MATE_PLY) {
+                    // Late move pruning
+                    // Skip the remaining quiet moves once enough moves have
+                    // been tried at low depth
+                    if (depth <= LMP_MAX_DEPTH && moveCount > (LMP_BASE + depth * depth) * (2 + improving) / 2) {
+                        movePicker.skipQuiets();
+                        continue;
+                    }
+                    // Futility pruning
+                    if (depth <= FUTILITY_MAX_DEPTH && evalScore + FUTILITY_BASE + FUTILITY_MARGIN * depth <= alpha) {
+                        continue;
+                    }
+                }
 
                 int extensions = 0;
+                // Singular extension
+                // If the TT move is the only move that holds up, by a margin,
+                // in a search of all others at reduced depth, search it
+                // deeper. If another move beats beta too, the node fails
+                // high (multi-cut), or at least the TT move needs less depth.
+                if (!rootNode && ttHit && move == entry.bestMove && excludedMove == Move() && depth >= SE_MIN_DEPTH
+                    && entry.bound != UPPER_BOUND && entry.depth >= depth - SE_TT_DEPTH_MARGIN
+                    && abs(entry.eval) < CHECKMATE_SCORE - MAX_MATE_PLY) {
+                    int singularBeta = entry.eval - SE_MARGIN * depth;
+                    ss->excludedMove = move;
+                    int score = negamaxSearch<Us, NON_PV>(ply, (depth - 1) / 2, singularBeta - 1, singularBeta, numExtensions);
+                    ss->excludedMove = Move();
+                    if (searchAborted) {
+                        return 0;
+                    }
+                    if (score < singularBeta) {
+                        if (numExtensions < MAX_NUM_EXTENSIONS) {
+                            extensions = 1;
+                        }
+                    } else if (singularBeta >= beta) {
+                        return beta;
+                    } else if (entry.eval >= beta) {
+                        extensions = -1;
+                    }
+                }
+
+                bool irreversible = isIrreversible(position, move);
+                ss->move = move;
+                ss->movedPiece = position.at(move.from());
+                ss->continuationHistory = &moveHistory->continuation[ss->movedPiece][move.to()];
+                PsqtState previousPsqtState = psqtState;
+                updatePsqtState<Us>(move);
                 position.play<Us>(move);
+                transpositionTable.prefetch(hashKey<~Us>());
+                repetitionTable.push(hashKey<~Us>(), irreversible);
                 // Search extension
                 // If the move is interesting, look 1 ply further
                 // Note: this increases search times drastically, but should be worth it
-                if (numExtensions < MAX_NUM_EXTENSIONS) {
+                if (extensions == 0 && numExtensions < MAX_NUM_EXTENSIONS) {
                     if (position.in_check<~Us>() || (type_of(position.at(move.to())) == PAWN && (rank_of(move.to()) == RANK2 || rank_of(move.to()) == RANK7))) {
                         extensions = 1;
                     }
                 }
 
-
-
                 int eval = 0;
-                bool needsFullSearch = true;
+                int newDepth = depth - 1 + extensions;
+                bool needsFullDepthSearch = !pvNode || moveCount > 1;
                 // Late move reductions
-                // Search moves with a low move score at a lower depth and tighter window
-                if (extensions == 0 && depth >= 3 && i >= 3 && !move.is_capture()) {
-                    eval = -negamaxSearch<~Us>(ply + 1, depth - 2, -alpha - 1, -alpha, numExtensions);
-                    needsFullSearch = eval > alpha;
+                // Search quiet moves late in the ordering at a lower depth and
+                // with a zero window first, the more so the later they come
+                // and the worse their history is
+                if (extensions == 0 && depth >= LMR_MIN_DEPTH && moveCount > LMR_MIN_MOVE && !isTactical(move)) {
+                    int reduction = REDUCTIONS(depth, moveCount);
+                    if constexpr (pvNode) {
+                        reduction -= LMR_PV_NODE;
+                    }
+                    if (!improving) {
+                        reduction += LMR_NOT_IMPROVING;
+                    }
+                    if (ttCapture) {
+                        reduction += LMR_TT_CAPTURE;
+                    }
+                    int historyScore = moveHistory->butterfly[Us][move.from()][move.to()]
+                                     + (*continuationHistories[0])[ss->movedPiece][move.to()]
+                                     + (*continuationHistories[1])[ss->movedPiece][move.to()];
+                    reduction -= historyScore / LMR_HISTORY_DIVISOR;
+                    int reducedDepth = clamp(newDepth - reduction / REDUCTION_SCALE, 1, newDepth);
+                    if (reducedDepth < newDepth) {
+                        eval = -negamaxSearch<~Us, NON_PV>(ply + 1, reducedDepth, -alpha - 1, -alpha, numExtensions);
+                        needsFullDepthSearch = eval > alpha;
+                    }
                 }
-                if (needsFullSearch) {
-                    eval = -negamaxSearch<~Us>(ply + 1, depth - 1 + extensions, -beta, -alpha, numExtensions + extensions);
+                if (needsFullDepthSearch) {
+                    eval = -negamaxSearch<~Us, NON_PV>(ply + 1, newDepth, -alpha - 1, -alpha, numExtensions + max(extensions, 0));
                 }
+                // The first move, and any later move that lands inside the
+                // window, gets a full window search to find its exact score
+                if (pvNode && (moveCount == 1 || (eval > alpha && (rootNode || eval < beta)))) {
+                    followPv = onPreviousPv && move == previousPv[ply];
+                    eval = -negamaxSearch<~Us, PV>(ply + 1, newDepth, -beta, -alpha, numExtensions + max(extensions, 0));
+                }
+                repetitionTable.pop();
                 position.undo<Us>(move);
+                psqtState = previousPsqtState;
+                if (searchAborted) {
+                    return 0;
+                }
 
-                if (ply == 0) {
+                if constexpr (rootNode) {
                     candidateMoves.push_back({move, eval});
                 }
 
                 if (eval >= beta) {
-                    transpositionTable.store(position.get_hash(), depth, beta, LOWER_BOUND, move);
-                    if (!move.is_capture() && killerMoves[ply][0] != move) {
-                        killerMoves[ply][1] = killerMoves[ply][0];
-                        killerMoves[ply][0] = move;
+                    if (excludedMove == Move()) {
+                        transpositionTable.store(positionHash, depth, scoreToTT(beta, ply), LOWER_BOUND, move, staticEval);
                     }
-
-                    // repetitionTable.TryPop() ???
+                    updateCutoffStats<Us>(ss, ply, depth, move, quietsSearched, numQuiets, capturesSearched, numCaptures);
                     ++numPruned;
                     return beta;
                 }
+                if (!isTactical(move)) {
+                    if (numQuiets < MAX_SEARCHED_MOVES) {
+                        quietsSearched[numQuiets++] = move;
+                    }
+                } else if (numCaptures < MAX_SEARCHED_MOVES) {
+                    capturesSearched[numCaptures++] = move;
+                }
                 if (eval > alpha) {
                     evaluationBound = EXACT;
-                    bestMove = orderedMoves[i].second;
-                    if (ply == 0) {
+                    bestMove = move;
+                    if constexpr (rootNode) {
                         bestMoveThisIteration = bestMove;
                     }
+                    if constexpr (pvNode) {
+                        updatePv(ply, move);
+                    }
                     alpha = eval;
                 }
             }
-            if (ply > 0) {
-                // repetitionTable.TryPop();
+            if (excludedMove == Move()) {
+                transpositionTable.store(positionHash, depth, scoreToTT(alpha, ply), evaluationBound, bestMove, staticEval);
             }
-            transpositionTable.store(position.get_hash(), depth, alpha, evaluationBound, bestMove);
             return alpha;
         }
 
         template<Color Us>
         int quiescenceSearch(int alpha, int beta) {
             ++numQuiescenceSearches;
-            int eval = evaluate<Us>();
+            nodes.store(nodes.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            int staticEval = evaluate<Us>();
+            int eval = staticEval;
             if (eval >= beta) {
                 ++numPruned;
                 return beta;
@@ -243,40 +835,42 @@ class ChessAI {
             }
 
 
-            TTEntry* entry = transpositionTable.probe(position.get_hash());
-            if (entry != nullptr && entry->depth == 0) {
+            uint64_t positionHash = hashKey<Us>();
+            TTData entry;
+            bool ttHit = transpositionTable.probe(positionHash, entry);
+            if (ttHit && entry.depth == 0) {
                 ++numTranspositionTableHits;
-                int storedEval = entry->eval;
-                int bound = entry->bound;
+                int storedEval = entry.eval;
+                int bound = entry.bound;
                 if (bound == EXACT) {
-                    if constexpr (Us == WHITE) {
-                        return -storedEval;
-                    } else {
-                        return storedEval;
-                    }
+                    return storedEval;
                 }
             }
 
             Bound evaluationBound = UPPER_BOUND;
-            MoveList<Us> legalMoves(position);
-            vector<pair<int, Move>> orderedMoves = orderMoves<Us>(legalMoves, -1, true);
-            for (int i = 0; i < orderedMoves.size(); ++i) {
-                Move move = orderedMoves[i].second;
+            MovePicker<Us> movePicker(position, ttHit ? entry.bestMove : Move(), *moveHistory);
+            for (Move move = movePicker.nextMove(); move != Move(); move = movePicker.nextMove()) {
+                // Captures that lose material in the exchange can't raise alpha
+                if (!seeGE<Us>(position, move, 0)) {
+                    continue;
+                }
                 // Delta Pruning
-                int capturedPieceValue;
-                if constexpr (Us == WHITE) {
-                    capturedPieceValue = -midgamePieceValues[position.at(move.to())];
-                } else {
-                    capturedPieceValue = midgamePieceValues[position.at(move.to())];
+                int capturedPieceValue = PIECE_TYPE_VALUES[capturedType(position, move)];
+                if (move.flags() == PR_QUEEN || move.flags() == PC_QUEEN) {
+                    capturedPieceValue += PIECE_TYPE_VALUES[QUEEN] - PIECE_TYPE_VALUES[PAWN];
                 }
                 if (eval + capturedPieceValue + 100 <= alpha) {
                     continue;
                 }
     
+                PsqtState previousPsqtState = psqtState;
+                updatePsqtState<Us>(move);
                 position.play<Us>(move);
+                transpositionTable.prefetch(hashKey<~Us>());
 
                 eval = -quiescenceSearch<~Us>(-beta, -alpha);
                 position.undo<Us>(move);
+                psqtState = previousPsqtState;
 
                 if (eval >= beta) {
                     ++numPruned;
@@ -288,7 +882,7 @@ class ChessAI {
                 }
             }
             if (evaluationBound == EXACT) {
-                transpositionTable.store(position.get_hash(), 0, alpha, evaluationBound, Move());
+                transpositionTable.store(positionHash, 0, alpha, evaluationBound, Move(), staticEval);
             }
             return alpha;
         }
@@ -310,115 +904,24 @@ class ChessAI {
             return evaluation;
         }
 
+        // Full recompute of the incremental material + PST state
+        PsqtState computePsqtState() const {
+            return tables.computeState(position);
+        }
+
+        // Updates the incremental state for a move about to be played by Us.
+        // Call it before position.play, and restore the previous state after
+        // position.undo.
+        template<Color Us>
+        inline void updatePsqtState(Move move) {
+            tables.update<Us>(psqtState, position, move);
+        }
+
+        // Tapered PST evaluation from the side to move's point of view
         template <Color Us>
         inline int evaluate() {
-            int midgameEvaluation = 0;
-            int endgameEvaluation = 0;
-            int gamePhase = 0;
-            for (int i = WHITE_PAWN; i < NO_PIECE; ++i) {
-                Piece piece = static_cast<Piece>(i);
-                Bitboard bitboard = position.bitboard_of(piece);
-                while (bitboard) {
-                    int square = __builtin_ctzll(bitboard);
-                    bitboard &= bitboard - 1;
-                    midgameEvaluation += midgamePieceValues[i] + tables.midgamePst[i][square];
-                    endgameEvaluation += endgamePieceValues[i] + tables.endgamePst[i][square];
-                    gamePhase += gamePhaseIncrement[i];
-                }
-            }
-            int midgamePhase = gamePhase;
-            if (midgamePhase < 24) {
-                midgamePhase = 24;
-            }
-            int endgamePhase = 24 - midgamePhase;
-            if constexpr (Us == BLACK) {
-                return -(midgamePhase * midgameEvaluation + endgamePhase * endgameEvaluation)/24;
-            }
-
-            return (midgamePhase * midgameEvaluation + endgamePhase * endgameEvaluation)/24;
-        }
-
-        // template <Color Us>
-        // int see(Bitboard occupancy, Square targetSquare, Piece occupyingTarget) {
-        //     int value = 0;
-        //     Square from = leastValuableAttacker<Us>(occupancy, targetSquare);
-        //     if (position.at(from) != NO_PIECE) {
-        //         occupancy &= ~squareToBitboard(from);
-        //         value = max(0, midgamePieceValues[occupyingTarget] - see<~Us>(occupancy, targetSquare, position.at(from)));
-        //     }
-        //     return value;
-        // }
-
-        // template <Color Us>
-        // int seeCapture(Move move) {
-        //     int value = 0;
-        //     Bitboard occupancy = Position::attackers_from<Us>()
-        // }
-
-        //        template <Color Us>
-        // int staticExchangeEvaluation(Bitboard occupancy, Square targetSquare) {
-        //     int gain[32];  // Material gain after each ply
-        //     int depth = 0;
-        //     // Bitboard usAttackers = Position::attackers_from<Us>(targetSquare, occupancy);
-        //     // Bitboard themAttackers = Position::attackers_from<~Us>(targetSquare, occupancy);
-        //     Bitboard attackers = usAttackers;
-        //     Color sideToMove = Us;
-        //     int score = midgamePieceValues[position.at(targetSquare)];
-            
-        //     gain[depth++] = score;
-        
-        //     while (attackers) {
-        //         // Find least valuable attacker
-        //         Square from;
-
-        //         Square from = leastValuableAttacker<Us>(attackers);
-        //         if (from == NO_SQUARE)
-        //             break;
-        
-        //         // Update
-        //         Piece attacker = position.at(from);
-        //         score = midgamePieceValues(attacker) - score;
-        //         gain[depth++] = score;
-        
-        //         // Remove attacking piece
-        //         occupancy ^= squareToBitboard(from);
-        //         // attackers &= ~squareToBitboard(from);
-        //         // attackers |= discoverNewAttackers(occupancy, from, targetSquare);
-        //         attackers = compute_attackers(occupancy, targetSquare);
-        //         sideToMove = ~sideToMove; // switch sides
-        //     }
-        
-        //     // Propagate minimax
-        //     while (--depth)
-        //         gain[depth-1] = -max(-gain[depth-1], gain[depth]);
-            
-        //     return gain[0];
-        // }
-
-        // inline Bitboard squareToBitboard(Square square) {
-        //     return 1ULL << square;
-        // }
-        
-        // template <Color Us>
-        // inline Square leastValuableAttacker(Bitboard attackers) {
-        //     Bitboard b = attackers;
-        //     if (b & position.bitboard_of(Us, PAWN)) {
-        //         return pop_lsb(b);
-        //     }
-        //     if (b & position.bitboard_of(Us, KNIGHT)) {
-        //         return pop_lsb(b);
-        //     }
-        //     if (b & position.bitboard_of(Us, BISHOP)) {
-        //         return pop_lsb(b);
-        //     }
-        //     if (b & position.bitboard_of(Us, ROOK)) {
-        //         return pop_lsb(b);
-        //     }
-        //     if (b & position.bitboard_of(Us, QUEEN)) {
-        //         return pop_lsb(b);
-        //     }
-        //     return NO_SQUARE;
-        // }
+            return tables.evaluate<Us>(psqtState, position);
+        }
 
         template<Color Us>
         void searchMoves(int depth, int alpha, int beta) {
@@ -427,7 +930,18 @@ class ChessAI {
             candidateMoves.clear();
             candidateMoves.resize(moves.size());
             chrono::steady_clock::time_point begin = chrono::steady_clock::now();
-            evaluation = negamaxSearch<Us>(0, depth, alpha, beta, 0);
+            followPv = true;
+            evaluation = negamaxSearch<Us, ROOT>(0, depth, alpha, beta, 0);
+            if (searchAborted) {
+                return;
+            }
+            // Only a score inside the window comes with a complete PV. After
+            // a failed aspiration search the re-search follows the previous
+            // PV, and a fail low leaves none behind.
+            if (alpha < evaluation && evaluation < beta && pvLength[0] > 0) {
+                previousPvLength = pvLength[0];
+                copy(pvTable[0], pvTable[0] + previousPvLength, previousPv);
+            }
             std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
             auto diff = end - begin;
             timeTakenPerIteration.push_back(chrono::duration_cast<chrono::microseconds>(diff).count()/1000000.0);
@@ -438,13 +952,22 @@ class ChessAI {
 
         template<Color Us>
         void iterativeDeepening() {
-            const double MAX_TIME_LIMIT = 1.0;
-            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-            for (int i = 1; i < 128; ++i) {
-                std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-                auto diff = end - start;
-                if (chrono::duration_cast<std::chrono::microseconds>(diff).count()/1000000.0 > MAX_TIME_LIMIT) {
-                    return;
+            psqtState = computePsqtState();
+            int maxDepth = limits.depth > 0 ? min(limits.depth, MAX_PLY - 1) : MAX_PLY - 1;
+            for (int i = 1; i <= maxDepth; ++i) {
+                if (threadId == 0) {
+                    if (i > 1 && timeManager.shouldStop(bestMoveChanges(), scoreDrop())) {
+                        return;
+                    }
+                } else {
+                    if (stopSearch.load(memory_order_relaxed)) {
+                        return;
+                    }
+                    // Helpers skip some depths so that threads don't all search the same iteration
+                    int pattern = (threadId - 1) % NUM_SKIP_PATTERNS;
+                    if (!bestMovePerIteration.empty() && ((i + SKIP_PHASE[pattern]) / SKIP_SIZE[pattern]) % 2) {
+                        continue;
+                    }
                 }
                 if (!evaluationPerIteration.empty()) {
                     bool validSearch = false;
@@ -453,6 +976,9 @@ class ChessAI {
                         int alpha = score - j;
                         int beta = score + j;
                         searchMoves<Us>(i, alpha, beta);
+                        if (searchAborted) {
+                            return;
+                        }
                         score = evaluationPerIteration[evaluationPerIteration.size() - 1];
                         if (alpha < score && score < beta) {
                             validSearch = true;
@@ -468,24 +994,168 @@ class ChessAI {
                 } else {
                     searchMoves<Us>(i, -64000, 64000);
                 }
+                if (searchAborted) {
+                    return;
+                }
+                completedDepth = i;
+                if (threadId == 0 && infoCallback) {
+                    reportIteration(*this);
+                }
             }
         }
 
+        // Number of the last 4 iterations that changed the best move
+        int bestMoveChanges() const {
+            int changes = 0;
+            int n = bestMovePerIteration.size();
+            for (int i = max(1, n - 4); i < n; ++i) {
+                changes += bestMovePerIteration[i] != bestMovePerIteration[i - 1];
+            }
+            return changes;
+        }
 
-        template<Color Us>
-        Move findMove() {
-            bool debug = false;
+        // How much the score fell in the last iteration
+        int scoreDrop() const {
+            int n = evaluationPerIteration.size();
+            return n < 2 ? 0 : evaluationPerIteration[n - 2] - evaluationPerIteration[n - 1];
+        }
+
+        // Sends the last iteration of thread, which is this thread or one of
+        // its helpers, with the nodes of all of them
+        void reportIteration(const ChessAI& thread) {
+            int score = thread.evaluationPerIteration.back();
+            bool isMate = abs(score) >= CHECKMATE_SCORE - MAX_MATE_PLY;
+            int mateIn = 0;
+            if (isMate) {
+                int plies = CHECKMATE_SCORE - abs(score);
+                mateIn = score > 0 ? (plies + 1) / 2 : -plies / 2;
+            }
+            infoCallback({thread.completedDepth, thread.maxDepthSearched, score, isMate, mateIn, totalNodes(), timeManager.elapsed(), thread.getPrincipalVariation()});
+        }
+
+        // Nodes searched so far by this thread and its helpers
+        uint64_t totalNodes() const {
+            uint64_t total = nodes.load(memory_order_relaxed);
+            for (const unique_ptr<ChessAI>& helper : helpers) {
+                total += helper->nodes.load(memory_order_relaxed);
+            }
+            return total;
+        }
+
+        // Resets the per-search state. Everything else, the table, history
+        // and killers, carries over from the previous search.
+        void prepareSearch() {
+            for (int i = 0; i < SEARCH_STACK_OFFSET; ++i) {
+                searchStack[i].move = Move();
+                searchStack[i].movedPiece = NO_PIECE;
+                searchStack[i].continuationHistory = &moveHistory->continuation[NO_PIECE][0];
+                searchStack[i].staticEval = EVAL_NONE;
+            }
             timeTakenPerIteration.clear();
             evaluationPerIteration.clear();
             bestMovePerIteration.clear();
-            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            // The root search doesn't set it without legal moves
+            bestMoveThisIteration = Move();
+            previousPvLength = 0;
+            searchAborted = false;
+            completedDepth = 0;
+            nodes = 0;
+            nextClockCheck = 0;
+            maxDepthSearched = 0;
+        }
+
+        // Runs iterative deepening on this thread and numThreads - 1 helpers.
+        // The helpers share the transposition table, so they mostly act as a
+        // way of filling it with useful entries for the main thread, but their
+        // results also take part in the vote on the best move.
+        template<Color Us>
+        Move lazySmpSearch() {
+            prepareSearch();
+            timeManager.init(limits, Us);
+            transpositionTable.newSearch();
+
+            repetitionTable.clear();
+            size_t first = gameHistory.size() - min(gameHistory.size(), (size_t) RepetitionTable::MAX_GAME_KEYS);
+            for (size_t i = first; i < gameHistory.size(); ++i) {
+                repetitionTable.push(gameHistory[i], false);
+            }
+            repetitionTable.push(hashKey<Us>(), false);
+
+            helpers.resize(numThreads - 1);
+            helperPositions.resize(numThreads - 1);
+            for (int i = 0; i < numThreads - 1; ++i) {
+                if (!helpers[i]) {
+                    helperPositions[i] = make_unique<Position>(position);
+                    helpers[i] = make_unique<ChessAI>(*helperPositions[i], *this, i + 1);
+                } else {
+                    rebuildPosition(*helperPositions[i], position);
+                    helpers[i]->repetitionTable = repetitionTable;
+                }
+                helpers[i]->prepareSearch();
+            }
+
+            vector<thread> workers;
+            for (unique_ptr<ChessAI>& helper : helpers) {
+                ChessAI* ai = helper.get();
+                workers.emplace_back([ai]() { ai->iterativeDeepening<Us>(); });
+            }
             iterativeDeepening<Us>();
+            stopSearch = true;
+            for (thread& worker : workers) {
+                worker.join();
+            }
+
+            // Vote on the best move, weighting each thread's choice by its
+            // score and the depth it completed
+            const ChessAI* voted = this;
+            Move votedMove = getBestMove();
+            int minEvaluation = getEvaluation();
+            for (unique_ptr<ChessAI>& helper : helpers) {
+                if (helper->completedDepth > 0) {
+                    minEvaluation = min(minEvaluation, helper->getEvaluation());
+                }
+            }
+            auto votes = [&](Move move) {
+                long long total = 0;
+                if (getBestMove() == move) {
+                    total += (long long) (getEvaluation() - minEvaluation + 14) * completedDepth;
+                }
+                for (unique_ptr<ChessAI>& helper : helpers) {
+                    if (helper->completedDepth > 0 && helper->getBestMove() == move) {
+                        total += (long long) (helper->getEvaluation() - minEvaluation + 14) * helper->completedDepth;
+                    }
+                }
+                return total;
+            };
+            long long bestVotes = votes(votedMove);
+            for (unique_ptr<ChessAI>& helper : helpers) {
+                if (helper->completedDepth > 0 && votes(helper->getBestMove()) > bestVotes) {
+                    voted = helper.get();
+                    votedMove = helper->getBestMove();
+                    bestVotes = votes(votedMove);
+                }
+            }
+            // The last info line came from this thread, so it doesn't match a
+            // move picked from a helper
+            if (voted != this && infoCallback) {
+                reportIteration(*voted);
+            }
+            return votedMove;
+        }
+
+
+        template<Color Us>
+        Move findMove() {
+            bool debug = false;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            resetStop();
+            Move bestMove = lazySmpSearch<Us>();
             std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
             auto diff = end - start;
             ofstream MyFile("searchlogs.txt", ios::app);
 
             // Write to the file
-            MyFile << "Promotion extensions - Time taken: " << chrono::duration_cast<std::chrono::microseconds>(diff).count()/1000000.0 << " | Max depth: " << maxDepthSearched << " | Eval: " << evaluationPerIteration.back() << " | Best move: " << bestMovePerIteration.back() << endl;
+            MyFile << "Promotion extensions - Time taken: " << chrono::duration_cast<std::chrono::microseconds>(diff).count()/1000000.0 << " | Max depth: " << maxDepthSearched << " | Eval: " << evaluationPerIteration.back() << " | Best move: " << bestMove << endl;
 
             // Close the file
             MyFile.close();
@@ -500,15 +1170,13 @@ class ChessAI {
 //            } else {
 //                cout << bestMovePerIteration[bestMovePerIteration.size() - 1] << endl;
             }
-            return bestMovePerIteration[bestMovePerIteration.size() - 1];
+            return bestMove;
         }
 
         template<Color Us>
         vector<pair<Move, int>> generateCandidateMoves() {
-            timeTakenPerIteration.clear();
-            evaluationPerIteration.clear();
-            bestMovePerIteration.clear();
-            iterativeDeepening<Us>();
+            resetStop();
+            lazySmpSearch<Us>();
             return candidateMoves;
         }
 };
\ No newline at end of file
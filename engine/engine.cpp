@@ -1,22 +1,31 @@
-#include "chess_ai.h"
+#include "engine_context.h"
 #include <iostream>
 
-// g++ -O3 -march=znver3 -mtune=znver3 -flto -o engine engine.cpp ./surge/src/types.cpp ./surge/src/position.cpp ./surge/src/tables.cpp
+// g++ -O3 -march=znver3 -mtune=znver3 -flto -pthread -o engine engine.cpp ./surge/src/types.cpp ./surge/src/position.cpp ./surge/src/tables.cpp ../src/nn/misc.cpp
 
-int main() {
+// Usage: engine [threads], then FENs on stdin, one per line. A move is
+// printed for every FEN, and the engine state is kept from one to the next.
+int main(int argc, char* argv[]) {
 	initialise_all_databases();
 	zobrist::initialise_zobrist_keys();
 
-    Position p;
+    int threads = 1;
+    if (argc > 1) {
+        threads = max(1, atoi(argv[1]));
+    }
+
+    EngineContext game;
+    game.engine().setThreads(threads);
+    SearchLimits limits;
+    limits.moveTime = DEFAULT_MOVE_TIME_MS;
     string fen;
-    getline(cin, fen);
-		Position::set(fen, p);
-		ChessAI ai = ChessAI(p);
-        if (p.turn() == WHITE) {
-            cout << ai.findMove<WHITE>() << endl;
-        } else {
-            cout << ai.findMove<BLACK>() << endl;
+    while (getline(cin, fen)) {
+        if (fen.empty()) {
+            continue;
         }
+        game.setPosition(fen);
+        cout << game.findMove(limits) << endl;
+    }
 
 
         // if (p.turn() == WHITE) {
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "chess_ai.h"
+#include <sstream>
+
+// Move() is written as the null move 0000, e.g. as the best move of a
+// position without legal moves
+inline string moveToUci(Move move) {
+    if (move == Move()) {
+        return "0000";
+    }
+    string str = string(SQSTR[move.from()]) + SQSTR[move.to()];
+    if (move.flags() & PR_KNIGHT) {
+        str += "nbrq"[move.flags() & 0b11];
+    }
+    return str;
+}
+
+// Finds the legal move with the given UCI string, or returns Move()
+template<Color Us>
+Move parseMove(Position& position, const string& str) {
+    MoveList<Us> moves(position);
+    for (Move move : moves) {
+        if (moveToUci(move) == str) {
+            return move;
+        }
+    }
+    return Move();
+}
+
+// Number of plies played before the position, from the side to move and
+// fullmove number of the FEN
+inline int gamePlyFromFen(const string& fen) {
+    istringstream is(fen);
+    string board, side, castling, enPassant;
+    int halfmoveClock = 0, fullmoveNumber = 1;
+    is >> board >> side >> castling >> enPassant >> halfmoveClock >> fullmoveNumber;
+    return 2 * max(0, fullmoveNumber - 1) + (side == "b");
+}
+
+// Everything the engine keeps for a whole game: the position with its move
+// history and a single ChessAI, which owns the transposition table, move
+// ordering tables and helper threads. Moving on to the next position of the
+// game is cheap and the next search starts warm from the previous one; the
+// table is only aged between searches and cleared on newGame.
+class EngineContext {
+    private:
+        Position position;
+        ChessAI ai;
+        // Keys of the positions since the last irreversible move, for
+        // repetition detection
+        vector<uint64_t> gameHistory;
+        int gamePly = 0;
+        int lastSearchPly = -1;
+        // Plies surge's undo history (256 entries) holds for the game, the
+        // rest is left for the search line
+        const int MAX_UNDO_PLIES = 64;
+
+        template<Color Us>
+        void playMove(Move move) {
+            if (isIrreversible(position, move)) {
+                // Nothing before the move can repeat, so start over from the
+                // new position. This also keeps long games within surge's
+                // fixed-size undo history.
+                position.play<Us>(move);
+                rebuildPosition(position, position.fen());
+                gameHistory.clear();
+            } else {
+                gameHistory.push_back(positionKey(position));
+                position.play<Us>(move);
+                // Long stretches of reversible moves are cut the same way,
+                // gameHistory keeps their keys
+                if (position.ply() >= MAX_UNDO_PLIES) {
+                    rebuildPosition(position, position.fen());
+                }
+            }
+            ++gamePly;
+        }
+
+    public:
+        EngineContext() : ai(position) {
+            rebuildPosition(position, DEFAULT_FEN);
+        }
+
+        ChessAI& engine() {
+            return ai;
+        }
+
+        const Position& getPosition() const {
+            return position;
+        }
+
+        void newGame() {
+            ai.newGame();
+            setPosition(DEFAULT_FEN);
+            lastSearchPly = -1;
+        }
+
+        // Sets up a new root position, e.g. the start of the game. Moves
+        // played from it are added with playMove.
+        void setPosition(const string& fen) {
+            rebuildPosition(position, fen);
+            gameHistory.clear();
+            gamePly = gamePlyFromFen(fen);
+        }
+
+        void playMove(Move move) {
+            if (position.turn() == WHITE) {
+                playMove<WHITE>(move);
+            } else {
+                playMove<BLACK>(move);
+            }
+        }
+
+        // Plays a move given in UCI notation, returning false if it isn't legal
+        bool playMove(const string& str) {
+            Move move = position.turn() == WHITE ? parseMove<WHITE>(position, str) : parseMove<BLACK>(position, str);
+            if (move == Move()) {
+                return false;
+            }
+            playMove(move);
+            return true;
+        }
+
+        // Hands the game so far to the engine before a search. Call from the
+        // thread that may later call stop.
+        void prepareSearch(const SearchLimits& limits) {
+            ai.setLimits(limits);
+            ai.setGameHistory(gameHistory);
+            if (lastSearchPly >= 0 && gamePly > lastSearchPly) {
+                ai.advanceRoot(gamePly - lastSearchPly);
+            }
+            lastSearchPly = gamePly;
+            ai.resetStop();
+        }
+
+        Move search() {
+            return position.turn() == WHITE ? ai.lazySmpSearch<WHITE>() : ai.lazySmpSearch<BLACK>();
+        }
+
+        Move findMove(const SearchLimits& limits) {
+            prepareSearch(limits);
+            return search();
+        }
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include "./surge/src/types.h"
+
+// Scores of the history tables stay within +-MAX_HISTORY, see updateHistoryEntry
+const int MAX_HISTORY = 16384;
+
+// Gravity update: the bonus (or malus, when negative) shrinks as the entry
+// approaches +-MAX_HISTORY, which keeps the scores bounded and lets recent
+// results outweigh old ones
+template<typename T>
+inline void updateHistoryEntry(T& entry, int bonus) {
+    bonus = std::clamp(bonus, -MAX_HISTORY, MAX_HISTORY);
+    entry += bonus - entry * abs(bonus) / MAX_HISTORY;
+}
+
+// Scores of quiet moves by moving piece and target square, following one
+// particular earlier move
+typedef int16_t PieceToHistory[NPIECES][NSQUARES];
+
+// Move ordering statistics learned from the cutoffs of the search. They are
+// kept from one search to the next and only cleared for a new game.
+struct MoveHistory {
+    // Quiet moves by side to move, from and to square ("butterfly" history)
+    int butterfly[NCOLORS][NSQUARES][NSQUARES];
+    // Captures and queen promotions by moving piece, target square and
+    // captured piece type, NPIECE_TYPES for a promotion without capture
+    int capture[NPIECES][NSQUARES][NPIECE_TYPES + 1];
+    // Quiet moves by the piece and target square of the move one ply
+    // earlier (the opponent's) and two plies earlier (our own). Entry
+    // [NO_PIECE][0] stands in for a null move or a ply before the root, and
+    // is never updated.
+    PieceToHistory continuation[NPIECES][NSQUARES];
+    // The quiet move that last refuted a move, by its piece and target square
+    Move counterMoves[NPIECES][NSQUARES];
+
+    void clear() {
+        std::fill(&butterfly[0][0][0], &butterfly[0][0][0] + sizeof(butterfly) / sizeof(int), 0);
+        std::fill(&capture[0][0][0], &capture[0][0][0] + sizeof(capture) / sizeof(int), 0);
+        std::fill(&continuation[0][0][0][0], &continuation[0][0][0][0] + sizeof(continuation) / sizeof(int16_t), 0);
+        std::fill(&counterMoves[0][0], &counterMoves[0][0] + NPIECES * NSQUARES, Move());
+    }
+};
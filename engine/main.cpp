@@ -1,9 +1,9 @@
-#include "chess_ai.h"
+#include "engine_context.h"
 
 #include <iostream>
 
 // git clone --branch hotfix-1 https://github.com/nkarve/surge.git
-// g++ -O3 -march=znver3 -mtune=znver3 -flto -o main main.cpp ./surge/src/types.cpp ./surge/src/position.cpp ./surge/src/tables.cpp
+// g++ -O3 -march=znver3 -mtune=znver3 -flto -pthread -o main main.cpp ./surge/src/types.cpp ./surge/src/position.cpp ./surge/src/tables.cpp ../src/nn/misc.cpp
 
 
 //Computes the perft of the position for a given depth, using bulk-counting
@@ -91,29 +91,27 @@ int main() {
 //	Position::set("6k1/2qr1p2/r5p1/p3p1QR/b1pbP3/BP6/2P4P/1K3R2 w - -", p);
 //	Position::set("1k6/8/1K6/8/8/8/8/5R2 w - -", p);
 //	Position::set("8/8/8/8/8/2k5/1q6/K7 w - -", p);
+	// One context for the whole game, so that every search starts from what
+	// the previous one learned
+	EngineContext game;
+	game.setPosition(gameFen);
+	SearchLimits limits;
+	limits.moveTime = DEFAULT_MOVE_TIME_MS;
 	if (true) {
 		while (true) {
-			Position p;
-			Position::set(gameFen, p);
-			ChessAI ai = ChessAI(p);
-			p.play<WHITE>(ai.findMove<WHITE>());
-			cout << p;
+			game.playMove(game.findMove(limits));
+			cout << game.getPosition();
 			string input;
 			cin >> input;
-			p.play<BLACK>(input);
-			gameFen = p.fen();
+			game.playMove(input);
 		}	
 	} else {
 		while (true) {
-			Position p;
-			Position::set(gameFen, p);
-			ChessAI ai = ChessAI(p);
 			string input;
 			cin >> input;
-			p.play<WHITE>(input);
-			p.play<BLACK>(ai.findMove<BLACK>());
-			gameFen = p.fen();
-			cout << p;
+			game.playMove(input);
+			game.playMove(game.findMove(limits));
+			cout << game.getPosition();
 		}	
 	}
 
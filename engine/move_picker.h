@@ -0,0 +1,251 @@
+#pragma once
+
+#include "./surge/src/types.h"
+#include "./surge/src/position.h"
+#include "./surge/src/tables.h"
+#include "see.h"
+#include "history.h"
+
+// surge's Move::is_capture() is true for any move with flags set, so check
+// the capture bit directly
+inline bool isCapture(Move move) {
+    return move.flags() & CAPTURE;
+}
+
+// Captures and queen promotions are searched in quiescence and ordered
+// before quiet moves
+inline bool isTactical(Move move) {
+    return isCapture(move) || move.flags() == PR_QUEEN;
+}
+
+inline PieceType capturedType(const Position& position, Move move) {
+    if (move.flags() == EN_PASSANT) {
+        return PAWN;
+    }
+    return type_of(position.at(move.to()));
+}
+
+enum PickerStage {
+    TT_MOVE,
+    INIT_CAPTURES,
+    GOOD_CAPTURES,
+    KILLERS,
+    COUNTER_MOVE,
+    INIT_QUIETS,
+    QUIETS,
+    BAD_CAPTURES,
+    DONE
+};
+
+struct ScoredMove {
+    Move move;
+    int score;
+};
+
+// Hands out the legal moves one at a time in stages: the TT move, captures
+// that don't lose material (by SEE) ordered by MVV-LVA and capture history,
+// killers, the countermove, quiet moves by butterfly and continuation
+// history, then losing captures ordered by SEE. surge only generates the full legal list, but moves are only
+// scored once their stage is reached, and each pick is a single selection
+// sort step, so a cutoff on an early move skips most of the ordering work.
+// Everything lives on the stack.
+template<Color Us>
+class MovePicker {
+    private:
+        Position& position;
+        MoveList<Us> legalMoves;
+        Move ttMove;
+        Move killers[2];
+        Move counterMove;
+        const MoveHistory& history;
+        // Continuation histories of the moves one and two plies earlier
+        const PieceToHistory* continuationHistory[2] = {};
+        bool capturesOnly;
+        bool skipQuietMoves = false;
+
+        PickerStage stage;
+        // Good captures and then quiets fill the array from the front, bad
+        // captures fill it from the back
+        static const int MAX_MOVES = 218;
+        ScoredMove moves[MAX_MOVES];
+        int current = 0;
+        int end = 0;
+        int badCapturesBegin = MAX_MOVES;
+        int killerIndex = 0;
+
+        bool isLegal(Move move) {
+            for (Move legal : legalMoves) {
+                if (legal == move) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void scoreCaptures() {
+            end = 0;
+            for (Move move : legalMoves) {
+                if (!isTactical(move) || move == ttMove) {
+                    continue;
+                }
+                Piece moving = position.at(move.from());
+                PieceType captured = capturedType(position, move);
+                int score = 10 * PIECE_TYPE_VALUES[captured] - PIECE_TYPE_VALUES[type_of(moving)]
+                    + history.capture[moving][move.to()][captured] / 16;
+                if (move.flags() == PR_QUEEN || move.flags() == PC_QUEEN) {
+                    score += 10 * PIECE_TYPE_VALUES[QUEEN];
+                }
+                if (!capturesOnly && !seeGE<Us>(position, move, 0)) {
+                    moves[--badCapturesBegin] = {move, staticExchangeEvaluation<Us>(position, move)};
+                } else {
+                    moves[end++] = {move, score};
+                }
+            }
+        }
+
+        void scoreQuiets() {
+            end = current;
+            Bitboard pawnAttacks = pawn_attacks<~Us>(position.bitboard_of(~Us, PAWN));
+            for (Move move : legalMoves) {
+                if (isTactical(move) || move == ttMove || move == killers[0] || move == killers[1] || move == counterMove) {
+                    continue;
+                }
+                Piece moving = position.at(move.from());
+                int score = history.butterfly[Us][move.from()][move.to()]
+                    + (*continuationHistory[0])[moving][move.to()]
+                    + (*continuationHistory[1])[moving][move.to()];
+                if (pawnAttacks & SQUARE_BB[move.to()]) {
+                    score -= 100;
+                }
+                moves[end++] = {move, score};
+            }
+        }
+
+        // One step of selection sort over [current, end)
+        Move pickBest() {
+            int best = current;
+            for (int i = current + 1; i < end; ++i) {
+                if (moves[i].score > moves[best].score) {
+                    best = i;
+                }
+            }
+            swap(moves[current], moves[best]);
+            return moves[current++].move;
+        }
+
+        void init() {
+            if (ttMove == Move() || (capturesOnly && !isTactical(ttMove)) || !isLegal(ttMove)) {
+                ttMove = Move();
+                stage = INIT_CAPTURES;
+            } else {
+                stage = TT_MOVE;
+            }
+        }
+
+    public:
+        // All moves, for the main search. killerMoves may be null, e.g. past
+        // the last ply with killers.
+        MovePicker(Position& p, Move tt, const Move* killerMoves, Move counter, const MoveHistory& moveHistory,
+                   const PieceToHistory* const continuationHistories[2]) :
+            position(p), legalMoves(p), ttMove(tt), counterMove(counter), history(moveHistory), capturesOnly(false) {
+            if (killerMoves != nullptr) {
+                killers[0] = killerMoves[0];
+                killers[1] = killerMoves[1];
+            }
+            continuationHistory[0] = continuationHistories[0];
+            continuationHistory[1] = continuationHistories[1];
+            init();
+        }
+
+        // Captures and queen promotions only, for the quiescence search
+        MovePicker(Position& p, Move tt, const MoveHistory& moveHistory) :
+            position(p), legalMoves(p), ttMove(tt), history(moveHistory), capturesOnly(true) {
+            init();
+        }
+
+        // Stops handing out quiet moves (other than the TT move if it was
+        // already handed out), for late move pruning. Losing captures still
+        // follow.
+        void skipQuiets() {
+            skipQuietMoves = true;
+        }
+
+        size_t size() const {
+            return legalMoves.size();
+        }
+
+        // Returns Move() once all moves have been picked
+        Move nextMove() {
+            switch (stage) {
+                case TT_MOVE:
+                    stage = INIT_CAPTURES;
+                    return ttMove;
+
+                case INIT_CAPTURES:
+                    scoreCaptures();
+                    stage = GOOD_CAPTURES;
+                    [[fallthrough]];
+
+                case GOOD_CAPTURES:
+                    if (current < end) {
+                        return pickBest();
+                    }
+                    if (capturesOnly) {
+                        stage = DONE;
+                        return Move();
+                    }
+                    stage = KILLERS;
+                    [[fallthrough]];
+
+                case KILLERS:
+                    while (!skipQuietMoves && killerIndex < 2) {
+                        Move killer = killers[killerIndex++];
+                        if (killerIndex == 2 && killer == killers[0]) {
+                            continue;
+                        }
+                        if (killer != Move() && killer != ttMove && !isTactical(killer) && isLegal(killer)) {
+                            return killer;
+                        }
+                    }
+                    stage = COUNTER_MOVE;
+                    [[fallthrough]];
+
+                case COUNTER_MOVE:
+                    stage = INIT_QUIETS;
+                    if (!skipQuietMoves && counterMove != Move() && counterMove != ttMove && counterMove != killers[0] && counterMove != killers[1]
+                        && !isTactical(counterMove) && isLegal(counterMove)) {
+                        return counterMove;
+                    }
+                    // Not handed out, so it has to be scored with the other quiets
+                    counterMove = Move();
+                    [[fallthrough]];
+
+                case INIT_QUIETS:
+                    if (!skipQuietMoves) {
+                        scoreQuiets();
+                    }
+                    stage = QUIETS;
+                    [[fallthrough]];
+
+                case QUIETS:
+                    if (!skipQuietMoves && current < end) {
+                        return pickBest();
+                    }
+                    current = badCapturesBegin;
+                    end = MAX_MOVES;
+                    stage = BAD_CAPTURES;
+                    [[fallthrough]];
+
+                case BAD_CAPTURES:
+                    if (current < end) {
+                        return pickBest();
+                    }
+                    stage = DONE;
+                    [[fallthrough]];
+
+                case DONE:
+                    return Move();
+            }
+            return Move();
+        }
+};
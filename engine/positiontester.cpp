@@ -1,8 +1,8 @@
-#include "chess_ai.h"
+#include "engine_context.h"
 
 #include <iostream>
 
-// g++ -O3 -march=znver3 -mtune=znver3 -flto -o positiontester positiontester.cpp ./surge/src/types.cpp ./surge/src/position.cpp ./surge/src/tables.cpp
+// g++ -O3 -march=znver3 -mtune=znver3 -flto -pthread -o positiontester positiontester.cpp ./surge/src/types.cpp ./surge/src/position.cpp ./surge/src/tables.cpp ../src/nn/misc.cpp
 
 int main() {
 	initialise_all_databases();
@@ -24,6 +24,17 @@ int main() {
         p.play<WHITE>(ai.findMove<WHITE>());
     }
 
-	return 0;
+    // Two searches back to back on one engine context, as the UCI front end
+    // runs them. The checkmated position must not return the move of the
+    // search before it.
+    EngineContext context;
+    SearchLimits limits;
+    limits.depth = 6;
+    context.findMove(limits);
+    context.setPosition("rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3");
+    string bestMove = moveToUci(context.findMove(limits));
+    cout << "bestmove " << bestMove << " after checkmate, expected 0000" << endl;
+
+	return bestMove == "0000" ? 0 : 1;
 }
 
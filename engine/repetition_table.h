@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include "./surge/src/types.h"
+#include "./surge/src/position.h"
+#include "./surge/src/tables.h"
+#include "transposition_table.h"
+
+// Cuckoo tables of the keys of every reversible (non-pawn) move on an empty
+// board, used to detect that the side to move can repeat an earlier position
+// with a single move. See Marcel van Kervinck's note on cycle detection.
+const int CUCKOO_SIZE = 8192;
+
+inline int cuckooH1(uint64_t key) {
+    return key & 0x1fff;
+}
+
+inline int cuckooH2(uint64_t key) {
+    return (key >> 16) & 0x1fff;
+}
+
+struct CuckooTables {
+    uint64_t keys[CUCKOO_SIZE] = {};
+    Move moves[CUCKOO_SIZE] = {};
+
+    // The zobrist keys have to be initialised before this runs
+    CuckooTables() {
+        for (int pc = WHITE_PAWN; pc < NO_PIECE; ++pc) {
+            PieceType pt = type_of(Piece(pc));
+            if (pt == PAWN || size_t(pt) >= NPIECE_TYPES) {
+                continue;
+            }
+            for (size_t s1 = a1; s1 < NSQUARES; ++s1) {
+                for (size_t s2 = s1 + 1; s2 < NSQUARES; ++s2) {
+                    if (!(pieceAttacks(pt, Square(s1)) & SQUARE_BB[s2])) {
+                        continue;
+                    }
+                    Move move = Move(Square(s1), Square(s2));
+                    uint64_t key = zobrist::zobrist_table[pc][s1] ^ zobrist::zobrist_table[pc][s2] ^ BLACK_TO_MOVE_KEY;
+                    int i = cuckooH1(key);
+                    // Kick out entries until one lands in an empty slot
+                    while (true) {
+                        swap(keys[i], key);
+                        swap(moves[i], move);
+                        if (move == Move()) {
+                            break;
+                        }
+                        i = (i == cuckooH1(key)) ? cuckooH2(key) : cuckooH1(key);
+                    }
+                }
+            }
+        }
+    }
+
+    static Bitboard pieceAttacks(PieceType pt, Square square) {
+        switch (pt) {
+            case KNIGHT: return attacks<KNIGHT>(square, 0);
+            case BISHOP: return attacks<BISHOP>(square, 0);
+            case ROOK: return attacks<ROOK>(square, 0);
+            case QUEEN: return attacks<QUEEN>(square, 0);
+            default: return attacks<KING>(square, 0);
+        }
+    }
+};
+
+inline const CuckooTables& cuckooTables() {
+    static const CuckooTables tables;
+    return tables;
+}
+
+// Captures, pawn moves, castling and promotions can't be undone, so no
+// position before them can repeat
+inline bool isIrreversible(const Position& position, Move move) {
+    return move.flags() != QUIET || type_of(position.at(move.from())) == PAWN;
+}
+
+// Stack of the keys of the positions in the game and the current search
+// line. Only positions since the last irreversible move (capture, pawn move,
+// castling or promotion) can repeat, so each entry also records how many
+// plies back the last irreversible move was.
+class RepetitionTable {
+    public:
+        static const int MAX_SIZE = 1024;
+        // Game positions pushed below the search line at most, which leaves
+        // room for any search line. Older positions can't repeat, the game
+        // is drawn after 150 reversible plies.
+        static const int MAX_GAME_KEYS = MAX_SIZE / 2;
+
+    private:
+        uint64_t keys[MAX_SIZE];
+        int reversiblePlies[MAX_SIZE];
+        int size = 0;
+
+    public:
+        void clear() {
+            size = 0;
+        }
+
+        void push(uint64_t key, bool irreversible) {
+            assert(size < MAX_SIZE);
+            keys[size] = key;
+            reversiblePlies[size] = (irreversible || size == 0) ? 0 : reversiblePlies[size - 1] + 1;
+            ++size;
+        }
+
+        void pop() {
+            assert(size > 0);
+            --size;
+        }
+
+        // Whether the position on top of the stack has occurred before. Only
+        // positions with the same side to move are compared, so the search
+        // scores the first repetition as a draw.
+        bool isRepetition() const {
+            int n = size - 1;
+            for (int i = 4; i <= reversiblePlies[n]; i += 2) {
+                if (keys[n - i] == keys[n]) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Whether the side to move has a reversible move that leads back to a
+        // position in the current search line, meaning it can force at least
+        // a draw. Only positions inside the search tree (fewer than ply
+        // plies back) are counted.
+        bool hasUpcomingRepetition(int ply, Bitboard occupancy) const {
+            int n = size - 1;
+            int end = reversiblePlies[n];
+            if (end < 3) {
+                return false;
+            }
+            const CuckooTables& cuckoo = cuckooTables();
+            uint64_t original = keys[n];
+            uint64_t other = original ^ keys[n - 1] ^ BLACK_TO_MOVE_KEY;
+
+            for (int i = 3; i <= end; i += 2) {
+                // other is zero when the opponent's moves since this position
+                // undid each other
+                other ^= keys[n - i + 1] ^ keys[n - i] ^ BLACK_TO_MOVE_KEY;
+                if (other != 0) {
+                    continue;
+                }
+                uint64_t moveKey = original ^ keys[n - i];
+                int j = cuckooH1(moveKey);
+                if (cuckoo.keys[j] != moveKey) {
+                    j = cuckooH2(moveKey);
+                    if (cuckoo.keys[j] != moveKey) {
+                        continue;
+                    }
+                }
+                Move move = cuckoo.moves[j];
+                if (!(SQUARES_BETWEEN_BB[move.from()][move.to()] & occupancy) && ply > i) {
+                    return true;
+                }
+            }
+            return false;
+        }
+};
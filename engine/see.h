@@ -0,0 +1,148 @@
+#pragma once
+
+#include "./surge/src/types.h"
+#include "./surge/src/position.h"
+#include "./surge/src/tables.h"
+
+// Material values by piece type used for move ordering and exchange
+// evaluation, the same as the midgame values used by the evaluation. The
+// extra entry is for type_of(NO_PIECE), i.e. the target square of a
+// non-capture.
+const int PIECE_TYPE_VALUES[NPIECE_TYPES + 1] = {82, 337, 365, 477, 1025, 0, 0};
+
+inline Bitboard piecesOf(const Position& position, Color side) {
+    return side == WHITE ? position.all_pieces<WHITE>() : position.all_pieces<BLACK>();
+}
+
+// All pieces of both colors attacking the square, including kings
+inline Bitboard attackersTo(const Position& position, Square square, Bitboard occupancy) {
+    return position.attackers_from<WHITE>(square, occupancy)
+        | position.attackers_from<BLACK>(square, occupancy)
+        | (attacks<KING>(square, occupancy) & (position.bitboard_of(WHITE_KING) | position.bitboard_of(BLACK_KING)));
+}
+
+// Finds the least valuable piece of the given color among the attackers,
+// returning its type and its square through from
+inline PieceType leastValuableAttacker(const Position& position, Color side, Bitboard attackers, Square& from) {
+    for (int pt = PAWN; pt <= KING; ++pt) {
+        Bitboard pieces = attackers & position.bitboard_of(side, PieceType(pt));
+        if (pieces) {
+            from = bsf(pieces);
+            return PieceType(pt);
+        }
+    }
+    from = NO_SQUARE;
+    return KING;
+}
+
+// Removing a piece from the exchange square can uncover sliders behind it,
+// so recompute the slider attacks with the new occupancy to pick up x-rays
+inline Bitboard xrayAttackers(const Position& position, PieceType moved, Square square, Bitboard occupancy) {
+    Bitboard attackers = 0;
+    if (moved == PAWN || moved == BISHOP || moved == QUEEN) {
+        attackers |= attacks<BISHOP>(square, occupancy) & (position.diagonal_sliders<WHITE>() | position.diagonal_sliders<BLACK>());
+    }
+    if (moved == ROOK || moved == QUEEN) {
+        attackers |= attacks<ROOK>(square, occupancy) & (position.orthogonal_sliders<WHITE>() | position.orthogonal_sliders<BLACK>());
+    }
+    return attackers;
+}
+
+// Static exchange evaluation: the material balance, from the mover's point
+// of view, of the capture sequence on the target square where both sides
+// always recapture with their least valuable piece and may stop at any time.
+// Castling, promotions and en passant are counted as 0.
+template<Color Us>
+int staticExchangeEvaluation(const Position& position, Move move) {
+    MoveFlags flags = move.flags();
+    if (flags != QUIET && flags != DOUBLE_PUSH && flags != CAPTURE) {
+        return 0;
+    }
+    Square from = move.from();
+    Square to = move.to();
+    int gain[32];
+    int depth = 0;
+    gain[0] = PIECE_TYPE_VALUES[type_of(position.at(to))];
+
+    Bitboard occupancy = (position.all_pieces<WHITE>() | position.all_pieces<BLACK>()) ^ SQUARE_BB[from];
+    Bitboard attackers = attackersTo(position, to, occupancy) & occupancy;
+    PieceType onTarget = type_of(position.at(from));
+    Color side = ~Us;
+
+    while (true) {
+        // Speculative gain if the side to recapture takes the piece on the
+        // target square, discarded below if it can't or won't
+        ++depth;
+        gain[depth] = PIECE_TYPE_VALUES[onTarget] - gain[depth - 1];
+        Square attackerSquare;
+        PieceType attacker = leastValuableAttacker(position, side, attackers, attackerSquare);
+        if (attackerSquare == NO_SQUARE) {
+            break;
+        }
+        // The king can't recapture onto a square the other side still attacks
+        if (attacker == KING && (attackers & piecesOf(position, ~side))) {
+            break;
+        }
+        occupancy ^= SQUARE_BB[attackerSquare];
+        attackers = (attackers | xrayAttackers(position, attacker, to, occupancy)) & occupancy;
+        onTarget = attacker;
+        side = ~side;
+    }
+
+    // Each side only continues the exchange if it gains by doing so
+    while (--depth > 0) {
+        gain[depth - 1] = -max(-gain[depth - 1], gain[depth]);
+    }
+    return gain[0];
+}
+
+// Fast path of the static exchange evaluation: tests whether the exchange
+// started by the move gains at least threshold, without computing its exact
+// value. Castling, promotions and en passant are counted as 0.
+template<Color Us>
+bool seeGE(const Position& position, Move move, int threshold) {
+    MoveFlags flags = move.flags();
+    if (flags != QUIET && flags != DOUBLE_PUSH && flags != CAPTURE) {
+        return 0 >= threshold;
+    }
+    Square from = move.from();
+    Square to = move.to();
+
+    int swap = PIECE_TYPE_VALUES[type_of(position.at(to))] - threshold;
+    if (swap < 0) {
+        return false;
+    }
+    swap = PIECE_TYPE_VALUES[type_of(position.at(from))] - swap;
+    if (swap <= 0) {
+        return true;
+    }
+
+    Bitboard occupancy = (position.all_pieces<WHITE>() | position.all_pieces<BLACK>()) ^ SQUARE_BB[from] ^ SQUARE_BB[to];
+    Bitboard attackers = attackersTo(position, to, occupancy);
+    Color side = Us;
+    int result = 1;
+
+    while (true) {
+        side = ~side;
+        attackers &= occupancy;
+        Bitboard sideAttackers = attackers & piecesOf(position, side);
+        if (!sideAttackers) {
+            break;
+        }
+        result ^= 1;
+
+        Square attackerSquare;
+        PieceType attacker = leastValuableAttacker(position, side, sideAttackers, attackerSquare);
+        // A king can only recapture if the other side has no attackers left
+        if (attacker == KING) {
+            return (attackers & ~sideAttackers & occupancy) ? result ^ 1 : result;
+        }
+        swap = PIECE_TYPE_VALUES[attacker] - swap;
+        if (swap < result) {
+            break;
+        }
+        occupancy ^= SQUARE_BB[attackerSquare];
+        attackers |= xrayAttackers(position, attacker, to, occupancy);
+    }
+    return result;
+}
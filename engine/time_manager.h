@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <algorithm>
+#include "./surge/src/types.h"
+
+// Search limits as given by the GUI, times in milliseconds. Zero means the
+// limit isn't set.
+struct SearchLimits {
+    int time[NCOLORS] = {0, 0};
+    int increment[NCOLORS] = {0, 0};
+    int movesToGo = 0;
+    int moveTime = 0;
+    int depth = 0;
+};
+
+// Time reserved per move for communication with the GUI
+const int MOVE_OVERHEAD_MS = 10;
+// Moves left in the game assumed when there is no movestogo
+const int DEFAULT_MOVES_TO_GO = 30;
+
+// Splits the remaining clock into a soft limit, checked between iterations
+// and scaled by how settled the search looks, and a hard limit, checked
+// inside the search, after which the current iteration is abandoned.
+class TimeManager {
+    private:
+        chrono::steady_clock::time_point start;
+        int64_t softLimit = 0;
+        int64_t hardLimit = 0;
+        bool timeLimited = false;
+        bool fixedTime = false;
+
+    public:
+        void init(const SearchLimits& limits, Color us) {
+            start = chrono::steady_clock::now();
+            timeLimited = limits.moveTime > 0 || limits.time[us] > 0;
+            fixedTime = limits.moveTime > 0;
+            if (limits.moveTime > 0) {
+                softLimit = hardLimit = max(1, limits.moveTime - MOVE_OVERHEAD_MS);
+                return;
+            }
+            if (limits.time[us] <= 0) {
+                return;
+            }
+            int64_t time = limits.time[us];
+            int64_t increment = limits.increment[us];
+            int movesToGo = limits.movesToGo > 0 ? min(limits.movesToGo, 50) : DEFAULT_MOVES_TO_GO;
+
+            // Time we can count on for the rest of the period, keeping some
+            // overhead back for every move
+            int64_t timeLeft = max<int64_t>(1, time + increment * (movesToGo - 1) - MOVE_OVERHEAD_MS * (2 + movesToGo));
+            // Never use more than 80% of the clock on one move
+            hardLimit = max<int64_t>(1, min(time * 4 / 5 - MOVE_OVERHEAD_MS, timeLeft / movesToGo * 5));
+            softLimit = min(hardLimit, timeLeft / movesToGo);
+        }
+
+        int64_t elapsed() const {
+            return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        }
+
+        // Whether another iteration should be started. bestMoveChanges is
+        // the number of recent iterations that changed the best move and
+        // scoreDrop how much the score fell over the last iteration, both of
+        // which mean the position needs more time.
+        bool shouldStop(int bestMoveChanges, int scoreDrop) const {
+            if (!timeLimited) {
+                return false;
+            }
+            if (fixedTime) {
+                return elapsed() >= softLimit;
+            }
+            double stability = bestMoveChanges == 0 ? 0.6 : 0.8 + 0.3 * min(bestMoveChanges, 4);
+            double falling = 1.0 + clamp(scoreDrop, 0, 100) / 100.0;
+            return elapsed() > softLimit * stability * falling;
+        }
+
+        bool hardLimitReached() const {
+            return timeLimited && elapsed() >= hardLimit;
+        }
+};
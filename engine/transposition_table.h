@@ -1,134 +1,199 @@
 #pragma once
 
-#include <vector>
 #include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
 #include "./surge/src/types.h"
 #include "./surge/src/position.h"
 #include "./surge/src/tables.h"
+#include "../src/nn/misc.h"
 
 enum Bound { LOWER_BOUND, UPPER_BOUND, EXACT };
 
-struct TTEntry {
-    uint64_t zobristHash = 0;
-    int depth = -1;
-    int eval = 0;
-    Bound bound = EXACT;
-    Move bestMove;
+// XORed into the hash when black is to move, so that positions with the
+// same placement but a different side to move (e.g. after a null move) get
+// separate transposition table entries
+const uint64_t BLACK_TO_MOVE_KEY = 0x9D39247E33776D41ULL;
 
-    bool isValid(uint64_t hash) const {
-        return zobristHash == hash;
-    }
-};
+// Key of the position as used by the transposition and repetition tables
+inline uint64_t positionKey(const Position& position) {
+    return position.turn() == BLACK ? position.get_hash() ^ BLACK_TO_MOVE_KEY : position.get_hash();
+}
 
-class TranspositionTable {
-public:
-    vector<TTEntry> table;
-    size_t tableSize;
+// Stored depths are offset so that qsearch entries (depth 0) are still
+// distinguishable from empty slots, which have depth8 == 0
+const int TT_DEPTH_OFFSET = -2;
 
-    TranspositionTable(size_t size) : tableSize(size) {
-        table.resize(tableSize);
-    }
+// The lower 2 bits of genBound8 hold the bound, the upper 6 bits the generation
+const uint8_t GENERATION_BITS = 2;
+const int GENERATION_DELTA = 1 << GENERATION_BITS;
+const int GENERATION_CYCLE = 255 + GENERATION_DELTA;
+const int GENERATION_MASK = (0xFF << GENERATION_BITS) & 0xFF;
+
+// Sentinel for entries stored without a static evaluation
+const int EVAL_NONE = 32001;
+
+// Unpacked copy of an entry, returned by probe
+struct TTData {
+    Move bestMove;
+    int eval = 0;
+    int staticEval = EVAL_NONE;
+    int depth = 0;
+    Bound bound = UPPER_BOUND;
+};
 
-    size_t index(uint64_t zobristHash) const {
-        return zobristHash % tableSize;
+// Packed 10-byte entry:
+// key        16 bit
+// bestMove   16 bit
+// eval       16 bit
+// staticEval 16 bit
+// depth       8 bit
+// generation  6 bit
+// bound       2 bit
+struct TTEntry {
+    uint16_t key16;
+    uint16_t move16;
+    int16_t eval16;
+    int16_t staticEval16;
+    uint8_t depth8;
+    uint8_t genBound8;
+
+    int depth() const {
+        return depth8 + TT_DEPTH_OFFSET;
     }
 
-    TTEntry* probe(uint64_t zobristHash) {
-        TTEntry& entry = table[index(zobristHash)];
-        if (entry.isValid(zobristHash)) {
-            return &entry;
-        }
-        return nullptr;
+    Bound bound() const {
+        return Bound(genBound8 & (GENERATION_DELTA - 1));
     }
 
-    void store(uint64_t zobristHash, int depth, int eval, Bound bound, Move bestMove) {
-        size_t idx = index(zobristHash);
-        TTEntry& entry = table[idx];
+    // How many searches ago this entry was written, in units of GENERATION_DELTA
+    uint8_t relativeAge(uint8_t generation8) const {
+        return (GENERATION_CYCLE + generation8 - genBound8) & GENERATION_MASK;
+    }
 
-        if (entry.zobristHash != zobristHash || depth >= entry.depth) {
-            entry = {zobristHash, depth, eval, bound, bestMove};
+    void save(uint16_t key, int depth, int eval, Bound bound, Move bestMove, int staticEval, uint8_t generation8) {
+        // Keep the old move if we don't have a new one for the same position
+        if (bestMove != Move() || key != key16) {
+            move16 = bestMove.to_from();
+        }
+        // Overwrite less valuable entries (cheapest checks first)
+        if (bound == EXACT || key != key16 || depth - TT_DEPTH_OFFSET + 4 > depth8 || relativeAge(generation8)) {
+            key16 = key;
+            depth8 = uint8_t(depth - TT_DEPTH_OFFSET);
+            genBound8 = uint8_t(generation8 | bound);
+            eval16 = int16_t(eval);
+            staticEval16 = int16_t(staticEval);
         }
-    }
-    
-    void clear() {
-        table.clear();
     }
 };
 
+// A cluster holds 3 entries plus padding, so two clusters share a 64-byte
+// cache line and a probe never touches more than one line. Probes and stores
+// are lock-free: racing writers can at worst leave a torn entry behind, which
+// the 16-bit key check rejects most of the time, and the search only ever
+// plays a TT move after finding it in the legal move list.
+const int CLUSTER_SIZE = 3;
 
+struct Cluster {
+    TTEntry entry[CLUSTER_SIZE];
+    char padding[2];
+};
 
+static_assert(sizeof(TTEntry) == 10, "Unexpected TTEntry size");
+static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
 
+class TranspositionTable {
+public:
+    TranspositionTable(size_t mbSize) {
+        resize(mbSize);
+    }
 
+    ~TranspositionTable() {
+        Stockfish::aligned_large_pages_free(table);
+    }
 
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+    // Reallocates the table with the given size in megabytes, using large
+    // pages where the OS allows it
+    void resize(size_t mbSize) {
+        Stockfish::aligned_large_pages_free(table);
+        clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+        table = static_cast<Cluster*>(Stockfish::aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+        if (table == nullptr) {
+            cerr << "Failed to allocate " << mbSize << "MB for transposition table." << endl;
+            exit(EXIT_FAILURE);
+        }
+        clear();
+    }
 
+    void clear() {
+        memset(table, 0, clusterCount * sizeof(Cluster));
+        generation8 = 0;
+    }
 
-// using namespace std;
-
-// #pragma once
-
-// #include <vector>
-// #include <iostream>
-// #include <cstdint>
-
-
-// enum Bound { LOWER_BOUND, UPPER_BOUND, EXACT };
-
-// struct TTEntry {
-//     uint64_t zobristHash;
-//     int depth;
-//     int eval;
-//     Bound bound;
-//     Move bestMove;
-// };
-
-// // Transposition Table class
-// class TranspositionTable {
-// public:
-//     vector<TTEntry> table;
-//     size_t tableSize;
+    // Called once at the start of every search, so that entries from earlier
+    // searches are preferred for replacement without having to clear the table
+    void newSearch() {
+        generation8 += GENERATION_DELTA;
+    }
 
-//     // Constructor to initialize the table size
-//     TranspositionTable(size_t size) : tableSize(size) {
-//         table.resize(tableSize);
-//         for (int i = 0; i < tableSize; i++) {
-//             table[i] = {0, -1, 0, EXACT, Move()};
-//         }
-//     }
+    TTEntry* firstEntry(uint64_t zobristHash) const {
+        // Multiply-shift maps the hash onto [0, clusterCount) without a division
+        return &table[(uint64_t) (((__uint128_t) zobristHash * (__uint128_t) clusterCount) >> 64)].entry[0];
+    }
 
-//     size_t hash(uint64_t zobristHash) {
-//         return zobristHash % tableSize;
-//     }
+    void prefetch(uint64_t zobristHash) const {
+        Stockfish::prefetch(firstEntry(zobristHash));
+    }
 
-//     bool contains(uint64_t zobristHash) {
-//         size_t key = hash(zobristHash);
-//         return table[key].depth > 0 && (table[key].zobristHash == zobristHash);
-//     }
+    bool probe(uint64_t zobristHash, TTData& data) const {
+        TTEntry* entry = firstEntry(zobristHash);
+        uint16_t key16 = uint16_t(zobristHash);
+        for (int i = 0; i < CLUSTER_SIZE; ++i) {
+            if (entry[i].key16 == key16 && entry[i].depth8) {
+                TTEntry copy = entry[i];
+                data = {Move(copy.move16), copy.eval16, copy.staticEval16, copy.depth(), copy.bound()};
+                return true;
+            }
+        }
+        return false;
+    }
 
-//     TTEntry get(uint64_t zobristHash) {
-//         size_t key = hash(zobristHash);
-//         if (table[key].zobristHash == zobristHash) {
-//             return table[key];
-//         }
-//         return table[hash(zobristHash)];
-//     }
+    void store(uint64_t zobristHash, int depth, int eval, Bound bound, Move bestMove, int staticEval = EVAL_NONE) {
+        TTEntry* entry = firstEntry(zobristHash);
+        uint16_t key16 = uint16_t(zobristHash);
+
+        // Reuse the slot of the same position if there is one, otherwise
+        // replace the entry with the lowest depth, discounting old entries
+        TTEntry* replace = entry;
+        for (int i = 0; i < CLUSTER_SIZE; ++i) {
+            if (entry[i].key16 == key16 || !entry[i].depth8) {
+                replace = &entry[i];
+                break;
+            }
+            if (replace->depth8 - 2 * replace->relativeAge(generation8) > entry[i].depth8 - 2 * entry[i].relativeAge(generation8)) {
+                replace = &entry[i];
+            }
+        }
+        replace->save(key16, depth, eval, bound, bestMove, staticEval, generation8);
+    }
 
-//     // Function to store a position in the table
-//     void store(uint64_t zobristHash, int depth, int eval, Bound bound, Move bestMove) {
-//         TTEntry entry{zobristHash, depth, eval, bound, bestMove};
-//         size_t key = hash(zobristHash);
-//         TTEntry existingEntry = table[key];
-//         if (zobristHash != existingEntry.zobristHash || depth > existingEntry.depth) {
-//             table[key] = entry;
-//         }
-//     }
+    // Approximate fill rate of the current search in permille
+    int hashfull() const {
+        int count = 0;
+        for (int i = 0; i < 1000; ++i) {
+            for (int j = 0; j < CLUSTER_SIZE; ++j) {
+                count += table[i].entry[j].depth8 && (table[i].entry[j].genBound8 & GENERATION_MASK) == generation8;
+            }
+        }
+        return count / CLUSTER_SIZE;
+    }
 
-//     int getNumEntries() {
-//         int numEntries = 0;
-//         for (int i = 0; i < tableSize; i++) {
-//             if (table[i].depth > 0) {
-//                 ++numEntries;
-//             }
-//         }
-//         return numEntries;
-//     }
-// };
\ No newline at end of file
+private:
+    Cluster* table = nullptr;
+    size_t clusterCount = 0;
+    uint8_t generation8 = 0;
+};
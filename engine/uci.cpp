@@ -0,0 +1,193 @@
+#include "engine_context.h"
+#include <iostream>
+#include <sstream>
+#include <mutex>
+
+// g++ -O3 -march=znver3 -mtune=znver3 -flto -pthread -o uci uci.cpp ./surge/src/types.cpp ./surge/src/position.cpp ./surge/src/tables.cpp ../src/nn/misc.cpp
+
+// Long-lived UCI front end. The engine context, and with it the
+// transposition table and move ordering tables, is kept for the whole
+// session instead of being rebuilt for every move. Searches run on their own
+// thread while this one keeps reading stdin, so stop, isready and quit are
+// answered right away.
+
+mutex outputMutex;
+
+void send(const string& line) {
+    lock_guard<mutex> lock(outputMutex);
+    cout << line << endl;
+}
+
+class UciEngine {
+    private:
+        EngineContext context;
+        thread searchThread;
+
+        const int MAX_HASH_MB = 65536;
+        const int MAX_THREADS = 256;
+
+        void waitForSearch() {
+            if (searchThread.joinable()) {
+                searchThread.join();
+            }
+        }
+
+        void uci() {
+            send("id name chess-ai");
+            send("id author David-Ykz");
+            send("option name Hash type spin default " + to_string(DEFAULT_HASH_MB) + " min 1 max " + to_string(MAX_HASH_MB));
+            send("option name Threads type spin default 1 min 1 max " + to_string(MAX_THREADS));
+            send("uciok");
+        }
+
+        // Reads the value of a spin option, clamped to [min, max]. Returns
+        // false if it isn't a number.
+        static bool parseSpin(const string& value, int min, int max, int& result) {
+            istringstream is(value);
+            long long number;
+            if (!(is >> number) || !is.eof()) {
+                return false;
+            }
+            result = (int) clamp<long long>(number, min, max);
+            return true;
+        }
+
+        void setOption(istringstream& is) {
+            string token, name, value;
+            is >> token;
+            while (is >> token && token != "value") {
+                name += (name.empty() ? "" : " ") + token;
+            }
+            is >> value;
+            int number;
+            if (name != "Hash" && name != "Threads") {
+                send("info string unknown option " + name);
+            } else if (!parseSpin(value, 1, name == "Hash" ? MAX_HASH_MB : MAX_THREADS, number)) {
+                send("info string invalid value " + value + " for option " + name);
+            } else {
+                waitForSearch();
+                if (name == "Hash") {
+                    context.engine().setHashSize(number);
+                } else {
+                    context.engine().setThreads(number);
+                }
+            }
+        }
+
+        // position [startpos | fen <fen>] [moves <move>...]
+        void setPosition(istringstream& is) {
+            string token, fen;
+            is >> token;
+            if (token == "startpos") {
+                fen = DEFAULT_FEN;
+                is >> token;
+            } else if (token == "fen") {
+                while (is >> token && token != "moves") {
+                    fen += token + " ";
+                }
+            } else {
+                return;
+            }
+            waitForSearch();
+            context.setPosition(fen);
+            while (is >> token) {
+                if (!context.playMove(token)) {
+                    send("info string illegal move " + token);
+                    break;
+                }
+            }
+        }
+
+        void go(istringstream& is) {
+            SearchLimits limits;
+            string token;
+            while (is >> token) {
+                if (token == "wtime") {
+                    is >> limits.time[WHITE];
+                } else if (token == "btime") {
+                    is >> limits.time[BLACK];
+                } else if (token == "winc") {
+                    is >> limits.increment[WHITE];
+                } else if (token == "binc") {
+                    is >> limits.increment[BLACK];
+                } else if (token == "movestogo") {
+                    is >> limits.movesToGo;
+                } else if (token == "movetime") {
+                    is >> limits.moveTime;
+                } else if (token == "depth") {
+                    is >> limits.depth;
+                }
+            }
+            waitForSearch();
+            context.prepareSearch(limits);
+            searchThread = thread([this]() {
+                send("bestmove " + moveToUci(context.search()));
+            });
+        }
+
+        static void printInfo(const SearchInfo& info) {
+            ostringstream os;
+            os << "info depth " << info.depth << " seldepth " << info.selectiveDepth;
+            if (info.isMate) {
+                os << " score mate " << info.mateIn;
+            } else {
+                os << " score cp " << info.score;
+            }
+            os << " nodes " << info.nodes << " time " << info.timeMs;
+            if (info.timeMs > 0) {
+                os << " nps " << info.nodes * 1000 / info.timeMs;
+            }
+            os << " pv";
+            for (Move move : info.pv) {
+                os << " " << moveToUci(move);
+            }
+            send(os.str());
+        }
+
+    public:
+        UciEngine() {
+            context.engine().setInfoCallback(printInfo);
+        }
+
+        ~UciEngine() {
+            context.engine().stop();
+            waitForSearch();
+        }
+
+        void loop() {
+            string line;
+            while (getline(cin, line)) {
+                istringstream is(line);
+                string command;
+                is >> command;
+                if (command == "uci") {
+                    uci();
+                } else if (command == "isready") {
+                    send("readyok");
+                } else if (command == "ucinewgame") {
+                    waitForSearch();
+                    context.newGame();
+                } else if (command == "setoption") {
+                    setOption(is);
+                } else if (command == "position") {
+                    setPosition(is);
+                } else if (command == "go") {
+                    go(is);
+                } else if (command == "stop") {
+                    context.engine().stop();
+                    waitForSearch();
+                } else if (command == "quit") {
+                    break;
+                }
+            }
+        }
+};
+
+int main() {
+    initialise_all_databases();
+    zobrist::initialise_zobrist_keys();
+
+    UciEngine engine;
+    engine.loop();
+    return 0;
+}
@@ -1,4 +1,6 @@
+import atexit
 import subprocess
+import chess
 
 def parseMoves(s):
     moveDictionary = {}
@@ -19,25 +21,74 @@ def parseMoves(s):
     
     return moveDictionary
 
-def getEngineMove(fen):
-    if "w" in fen:
-        engine = subprocess.Popen(["../engine/midgamepst"], stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
-    else:
-        engine = subprocess.Popen(["../engine/basicpst"], stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
-    engine.stdin.write(fen)
-    engine.stdin.write("\n")
-    engine.stdin.flush()
-    move = engine.stdout.readline().rstrip("\n")
-    engine.stdin.close()
-    engine.stdout.close()
-    engine.wait()
-    
-    if move[4:5] == " ":
-        move = move[0:4]
-    else:
-        move = move[0:4] + str(move[4:5]).lower()
+class UciEngine:
+    """Long-lived engine process spoken to over UCI, so that start-up and
+    table allocation are paid once rather than on every move."""
+
+    def __init__(self, path):
+        self.process = subprocess.Popen([path], stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+        self.send("uci")
+        self.waitFor("uciok")
+
+    def send(self, command):
+        self.process.stdin.write(command + "\n")
+        self.process.stdin.flush()
+
+    def waitFor(self, prefix):
+        while True:
+            line = self.process.stdout.readline()
+            if not line:
+                raise RuntimeError("Engine exited unexpectedly")
+            if line.startswith(prefix):
+                return line.rstrip("\n")
+
+    def newGame(self):
+        self.send("ucinewgame")
+        self.send("isready")
+        self.waitFor("readyok")
+
+    def bestMove(self, board, moveTime):
+        # The moves since the root let the engine see repetitions and keep
+        # its tables warm, which a bare FEN would hide
+        if board.root().fen() == chess.STARTING_FEN:
+            position = "position startpos"
+        else:
+            position = f"position fen {board.root().fen()}"
+        if board.move_stack:
+            position += " moves " + " ".join(move.uci() for move in board.move_stack)
+        self.send(position)
+        self.send(f"go movetime {moveTime}")
+        return self.waitFor("bestmove").split()[1]
+
+    def quit(self):
+        self.send("quit")
+        self.process.stdin.close()
+        self.process.wait()
+
+
+# One engine per side, so that two builds can be played against each other.
+# The old per-side binaries (midgamepst for white, basicpst for black) read a
+# bare FEN on stdin; point these at UCI builds of the variants instead.
+ENGINE_PATHS = {chess.WHITE: "../engine/uci", chess.BLACK: "../engine/uci"}
+MOVE_TIME_MS = 1000
+engines = {}
+
+def getEngineMove(board):
+    if board.turn not in engines:
+        engines[board.turn] = UciEngine(ENGINE_PATHS[board.turn])
+        engines[board.turn].newGame()
+    return engines[board.turn].bestMove(board, MOVE_TIME_MS)
+
+def newEngineGame():
+    for engine in engines.values():
+        engine.newGame()
+
+def quitEngines():
+    for engine in engines.values():
+        engine.quit()
+    engines.clear()
 
-    return move
+atexit.register(quitEngines)
 
 def getEngineMoves(fen):
     if "b" in fen:
@@ -1,5 +1,5 @@
 import asyncio
-from interface import getEngineMove
+from interface import getEngineMove, newEngineGame
 from tables import getOpeningMove
 import chess
 import chess.pgn
@@ -8,6 +8,7 @@ async def main():
     board = chess.Board()
     startingFen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -"
     numOpeningMoves = 4
+    newEngineGame()
 
     while not board.is_game_over():
         move = ""
@@ -19,7 +20,7 @@ async def main():
             move = chess.Move.from_uci(move)
             numOpeningMoves -= 1
         else:
-            move = chess.Move.from_uci(getEngineMove(board.fen()))
+            move = chess.Move.from_uci(getEngineMove(board))
 
         print(move)
         if move in board.legal_moves:
@@ -38,6 +39,7 @@ def playMatch(enginePath, skillLevel):
     engine1 = chess.engine.SimpleEngine.popen_uci(enginePath)
     engine1.configure({"Skill Level": skillLevel})
     board = chess.Board()
+    newEngineGame()
     board.push(chess.Move.from_uci("e2e4"))
     board.push(chess.Move.from_uci("e7e5"))
     board.push(chess.Move.from_uci("g1f3"))
@@ -45,7 +47,7 @@ def playMatch(enginePath, skillLevel):
     board.push(chess.Move.from_uci("f1b5"))
     board.push(chess.Move.from_uci("a7a6"))
     while not board.is_game_over():
-        move = getEngineMove(board.fen())
+        move = getEngineMove(board)
         move = chess.Move.from_uci(move)
 #        print(f"Move {board.fullmove_number}: {board.san(move)}")
         board.push(move)
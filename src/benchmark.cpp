@@ -1,5 +1,32 @@
 #include "search.h"
 
+#ifdef USE_NNUE
+// Position 5 keeps black's queenside castling right with the king on g8, so
+// surge generates e8c8, a move from an empty square, unless the right is
+// dropped first (see castling.h). Making and unmaking it on the NNUE
+// position must leave the board and its evaluation unchanged.
+bool checkStaleCastlingRight(Position& position) {
+    int pieces[32];
+    int squares[32];
+    int pieceAmount = 0;
+    for (int square = a1; square <= h8; ++square) {
+        Piece piece = position.at(Square(square));
+        if (piece != NO_PIECE) {
+            pieces[pieceAmount] = piece + 1;
+            squares[pieceAmount] = square;
+            ++pieceAmount;
+        }
+    }
+    Stockfish::Probe::Evaluator nnue;
+    nnue.set(pieces, squares, pieceAmount, position.turn() == WHITE, 0);
+    int expected = nnue.eval();
+    nnue.do_move(e8, c8);
+    nnue.undo_move();
+    return nnue.eval() == expected
+        && nnue.eval() == Stockfish::Probe::eval(pieces, squares, pieceAmount, position.turn() == WHITE, 0);
+}
+#endif
+
 int main() {
     string positions[] = {
         "8/8/8/8/6p1/8/8/1k1K4 b - -",
@@ -17,9 +44,14 @@ int main() {
     };
     int evaluations[] = {0, 0, 0, 41, -36, -7, 0, 0, 0, -9, 73, 0};
 
+#ifdef USE_NNUE
+    cout << "NNUE kernels: " << Stockfish::Probe::kernels() << endl;
+#endif
+
     for (int i = 0; i < 12; i++) {
         Position p;
         Position::set(positions[i], p);
+        dropStaleCastlingRights(p);
         Search s = Search(p);
         if (p.turn() == WHITE) {
             cout << s.search<WHITE>();
@@ -28,5 +60,15 @@ int main() {
         }
     }
 
+#ifdef USE_NNUE
+    // After the searches, which load the network
+    Position stale;
+    Position::set(positions[4], stale);
+    if (!checkStaleCastlingRight(stale)) {
+        cerr << "NNUE position corrupted by e8c8 in " << positions[4] << endl;
+        return 1;
+    }
+#endif
+
     return 0;
 }
\ No newline at end of file
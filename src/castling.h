@@ -0,0 +1,17 @@
+#pragma once
+
+// surge takes the castling rights of a FEN as they are, and generates
+// castling moves for them even when the king or the rook isn't on its start
+// square, e.g. benchmark position 5 (black to move, q, king on g8). Playing
+// such a move moves a piece that isn't there. This drops those rights by
+// marking the squares as moved, which is how surge records a lost right.
+// Include it after surge's position.h.
+inline void dropStaleCastlingRights(Position& position) {
+    const Square squares[6] = {e1, a1, h1, e8, a8, h8};
+    const Piece pieces[6] = {WHITE_KING, WHITE_ROOK, WHITE_ROOK, BLACK_KING, BLACK_ROOK, BLACK_ROOK};
+    for (int i = 0; i < 6; ++i) {
+        if (position.at(squares[i]) != pieces[i]) {
+            position.history[position.ply()].entry |= SQUARE_BB[squares[i]];
+        }
+    }
+}
@@ -5,64 +5,94 @@
 
 class Evaluation {
 private:
-    int midgamePieceValues[14] = {82, 337, 365, 477, 1025, 0, 0, 0, -82, -337, -365, -477, -1025, 0};
-    int endgamePieceValues[14] = {94, 281, 297, 512, 936, 0, 0, 0, -94, -281, -297, -512, -936, 0};
-    int gamePhaseIncrement[14] = {0, 1, 1, 2, 4, 0, 0, 0, 0, 1, 1, 2, 4, 0};
     PST tables;
+    PsqtState psqtState;
+#ifdef USE_NNUE
+    // NNUE position kept in step with the search, see update and undo
+    Stockfish::Probe::Evaluator nnue;
+#endif
 
-public:
-    void initialize(string modelName) {
-        Stockfish::Probe::init(modelName.c_str(), modelName.c_str());
-    }
-
-    template <Color Us>
-    inline int evaluate(Position& position) {
-        int midgameEvaluation = 0;
-        int endgameEvaluation = 0;
-        int gamePhase = 0;
+    // Lists the pieces and squares of the position in the NNUE's encoding
+    // (piece + 1), returning the number of pieces
+    static int nnuePieces(Position& position, int pieces[], int squares[]) {
+        int index = 0;
         for (int i = WHITE_PAWN; i < NO_PIECE; ++i) {
-            Piece piece = static_cast<Piece>(i);
-            Bitboard bitboard = position.bitboard_of(piece);
+            Bitboard bitboard = position.bitboard_of(static_cast<Piece>(i));
             while (bitboard) {
                 int square = __builtin_ctzll(bitboard);
                 bitboard &= bitboard - 1;
-                midgameEvaluation += midgamePieceValues[i] + tables.midgamePst[i][square];
-                endgameEvaluation += endgamePieceValues[i] + tables.endgamePst[i][square];
-                gamePhase += gamePhaseIncrement[i];
+                pieces[index] = i + 1;
+                squares[index] = square;
+                ++index;
             }
         }
-        int midgamePhase = gamePhase;
-        if (midgamePhase < 24) {
-            midgamePhase = 24;
-        }
-        int endgamePhase = 24 - midgamePhase;
-        if constexpr (Us == BLACK) {
-            return -(midgamePhase * midgameEvaluation + endgamePhase * endgameEvaluation)/24;
-        }
+        return index;
+    }
+
+public:
+    void initialize(string modelName) {
+        Stockfish::Probe::init(modelName.c_str(), modelName.c_str());
+    }
+
+    // Sets up the incremental state for a new root position
+    void refresh(Position& position) {
+        psqtState = tables.computeState(position);
+#ifdef USE_NNUE
+        int pieces[32];
+        int squares[32];
+        int pieceAmount = nnuePieces(position, pieces, squares);
+        nnue.set(pieces, squares, pieceAmount, position.turn() == WHITE, 0);
+#endif
+    }
+
+    PsqtState getState() const {
+        return psqtState;
+    }
+
+    // Takes back update: restores the state saved with getState before it
+    // and unmakes the move on the NNUE position
+    void undo(PsqtState state) {
+        psqtState = state;
+#ifdef USE_NNUE
+        nnue.undo_move();
+#endif
+    }
 
-        return (midgamePhase * midgameEvaluation + endgamePhase * endgameEvaluation)/24;
+    // Updates the incremental state for a move about to be played by Us.
+    // Call it before position.play, and undo with the state saved with
+    // getState after position.undo.
+    template <Color Us>
+    inline void update(Position& position, Move move) {
+#ifdef USE_NNUE
+        MoveFlags flags = move.flags();
+        nnue.do_move(move.from(), move.to(), (flags & PR_KNIGHT) ? KNIGHT + (flags & 0b11) + 1 : 0);
+#endif
+        tables.update<Us>(psqtState, position, move);
+    }
+
+    // Tapered PST evaluation from the side to move's point of view
+    template <Color Us>
+    inline int evaluate(Position& position) {
+        return tables.evaluate<Us>(psqtState, position);
     }
 
 
+#ifdef USE_NNUE
+    // NNUE evaluation of the position reached through update, from the side
+    // to move's point of view
     template <Color Us>
-    static int nnueevaluate(Position& position) {
+    inline int nnueevaluate([[maybe_unused]] Position& position) {
+#ifdef DEBUG_EVAL
         int pieces[32];
         int squares[32];
-        int index = 0;
-        for (int i = WHITE_PAWN; i < NO_PIECE; ++i) {
-            Bitboard bitboard = position.bitboard_of(static_cast<Piece>(i));
-            while (bitboard) {
-                int square = __builtin_ctzll(bitboard);
-                bitboard &= bitboard - 1;
-                pieces[index] = i + 1;
-                squares[index] = square;
-                ++index;
-            }
-        }
-        if constexpr (Us == WHITE) {
-            return Stockfish::Probe::eval(pieces, squares, index, true, 0);
-        } else {
-            return Stockfish::Probe::eval(pieces, squares, index, false, 0);
+        int pieceAmount = nnuePieces(position, pieces, squares);
+        int expected = Stockfish::Probe::eval(pieces, squares, pieceAmount, Us == WHITE, nnue.rule50_count());
+        if (expected != nnue.eval()) {
+            cerr << "Incremental NNUE mismatch in " << position.fen() << endl;
+            abort();
         }
+#endif
+        return nnue.eval();
     }
+#endif
 };
\ No newline at end of file
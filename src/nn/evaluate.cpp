@@ -19,15 +19,20 @@
 #include "evaluate.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <unordered_map>
 #include <vector>
 
 #include "incbin/incbin.h"
-#include "nnue/evaluate_nnue.h"
+#include "nnue/nnue_accumulator.h"
+#include "nnue/nnue_architecture.h"
+#include "nnue/nnue_dispatch.h"
 #include "position.h"
 #include "types.h"
 
@@ -55,6 +60,29 @@ namespace Stockfish {
 
 namespace Eval {
 
+    // Bumped on every net load, so that refresh caches built from the
+    // previous net's biases and weights can tell they are stale
+    static std::atomic<std::uint64_t> netGeneration{0};
+
+    static void clear_stale_caches(NNUE::AccumulatorCaches& caches) {
+
+        std::uint64_t generation = netGeneration.load(std::memory_order_relaxed);
+        if (caches.netGeneration != generation)
+        {
+            caches.clear();
+            caches.netGeneration = generation;
+        }
+    }
+
+    // Whether both files exist and the first was written after the second
+    static bool is_newer(const std::string& file, const std::string& than) {
+
+        std::error_code ec1, ec2;
+        auto            fileTime = std::filesystem::last_write_time(file, ec1);
+        auto            thanTime = std::filesystem::last_write_time(than, ec2);
+        return !ec1 && !ec2 && fileTime >= thanTime;
+    }
+
     NNUE::EvalFiles NNUE::load_networks(const std::string& rootDirectory,
                                         NNUE::EvalFiles    evalFiles) {
 
@@ -62,11 +90,13 @@ namespace Eval {
         {
             std::string user_eval_file = evalFile.defaultName;
 
+            // The embedded net comes last, as it is used whatever the name
+            // and would hide a named net file and its pre-decoded copy
 #if defined(DEFAULT_NNUE_DIRECTORY)
-            std::vector<std::string> dirs = {"<internal>", "", rootDirectory,
-                                         stringify(DEFAULT_NNUE_DIRECTORY)};
+            std::vector<std::string> dirs = {"", rootDirectory, stringify(DEFAULT_NNUE_DIRECTORY),
+                                             "<internal>"};
 #else
-            std::vector<std::string> dirs = {"<internal>", "", rootDirectory};
+            std::vector<std::string> dirs = {"", rootDirectory, "<internal>"};
 #endif
 
             for (const std::string& directory : dirs)
@@ -75,18 +105,47 @@ namespace Eval {
                 {
                     if (directory != "<internal>")
                     {
-                        std::ifstream stream(directory + user_eval_file, std::ios::binary);
-                        auto          description = NNUE::load_eval(stream, netSize);
+                        // Map the pre-decoded copy of the net if it is up to
+                        // date, otherwise decode the net and write the copy for
+                        // the next process
+                        const NNUE::Kernels&       kernels    = NNUE::kernels();
+                        std::string                path       = directory + user_eval_file;
+                        std::string                mappedPath = path + "." + kernels.tag + ".map";
+                        std::optional<std::string> description;
+
+                        if (is_newer(mappedPath, path))
+                            description = kernels.map_eval(mappedPath, netSize);
+
+                        if (!description.has_value())
+                        {
+                            std::ifstream stream(path, std::ios::binary);
+                            description = kernels.load_eval(stream, netSize);
+
+                            if (description.has_value())
+                                kernels.save_mapped_eval(mappedPath, netSize, description.value());
+                        }
 
                         if (description.has_value())
                         {
                             evalFile.current        = user_eval_file;
                             evalFile.netDescription = description.value();
+                            ++netGeneration;
                         }
                     }
 
                     if (directory == "<internal>" && user_eval_file == evalFile.defaultName)
                     {
+                        // The embedded net has no file to keep its pre-decoded
+                        // copy next to, so the copy goes where the net was
+                        // embedded from. The net's name carries its SHA256, so
+                        // a copy under it can't be of another net.
+                        const NNUE::Kernels& kernels    = NNUE::kernels();
+                        std::string          mappedPath = std::string(netSize == Small
+                                                                        ? EvalFileDefaultNameSmall
+                                                                        : EvalFileDefaultNameBig)
+                                                 + "." + kernels.tag + ".map";
+                        std::optional<std::string> description = kernels.map_eval(mappedPath, netSize);
+
                         // C++ way to prepare a buffer for a memory stream
                         class MemoryBuffer: public std::basic_streambuf<char> {
                         public:
@@ -103,14 +162,20 @@ namespace Eval {
                         (void) gEmbeddedNNUEBigEnd;  // Silence warning on unused variable
                         (void) gEmbeddedNNUESmallEnd;
 
-                        std::istream stream(&buffer);
-                        auto         description = NNUE::load_eval(stream, netSize);
+                        if (!description.has_value())
+                        {
+                            std::istream stream(&buffer);
+                            description = kernels.load_eval(stream, netSize);
 
+                            if (description.has_value())
+                                kernels.save_mapped_eval(mappedPath, netSize, description.value());
+                        }
 
                         if (description.has_value())
                         {
                             evalFile.current        = user_eval_file;
                             evalFile.netDescription = description.value();
+                            ++netGeneration;
                         }
                     }
                 }
@@ -130,15 +195,9 @@ int Eval::simple_eval(const Position& pos, Color c) {
 }
 
 
-    Value Eval::evaluate(const Position& pos) {
-
-        int  simpleEval = simple_eval(pos, pos.side_to_move());
-        bool smallNet   = std::abs(simpleEval) > 1050;
-
-        int nnueComplexity;
-
-        Value nnue = smallNet ? NNUE::evaluate<NNUE::Small>(pos, true, &nnueComplexity)
-                              : NNUE::evaluate<NNUE::Big>(pos, true, &nnueComplexity);
+    // Scales the network output by the material left and damps it when
+    // shuffling
+    static Value scale_nnue(const Position& pos, int simpleEval, Value nnue, int nnueComplexity) {
 
         nnue -= nnue * (nnueComplexity + std::abs(simpleEval - nnue)) / 32768;
 
@@ -154,4 +213,61 @@ int Eval::simple_eval(const Position& pos, Color c) {
 
         return v;
     }
+
+    Value Eval::evaluate(const Position& pos, NNUE::AccumulatorStack& stack, NNUE::AccumulatorCaches& caches) {
+
+        int  simpleEval = simple_eval(pos, pos.side_to_move());
+        bool smallNet   = std::abs(simpleEval) > 1050;
+
+        int nnueComplexity;
+
+        clear_stale_caches(caches);
+
+        const NNUE::Kernels& kernels = NNUE::kernels();
+        Value nnue = smallNet ? kernels.evaluate_small(pos, stack, caches, true, &nnueComplexity)
+                              : kernels.evaluate_big(pos, stack, caches, true, &nnueComplexity);
+
+        return scale_nnue(pos, simpleEval, nnue, nnueComplexity);
+    }
+
+    // Same as evaluate for count unrelated positions. The positions are split
+    // between the two networks and each network evaluates its share in
+    // batches, which is much faster than one call per position.
+    void Eval::evaluate_batch(const Position* const    positions[],
+                              std::size_t              count,
+                              Value                    values[],
+                              NNUE::AccumulatorStack&  stack,
+                              NNUE::AccumulatorCaches& caches) {
+
+        std::vector<int>             simpleEvals(count);
+        std::vector<std::size_t>     indices[2];
+        std::vector<const Position*> netPositions[2];
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            simpleEvals[i] = simple_eval(*positions[i], positions[i]->side_to_move());
+            bool smallNet  = std::abs(simpleEvals[i]) > 1050;
+            indices[smallNet].push_back(i);
+            netPositions[smallNet].push_back(positions[i]);
+        }
+
+        clear_stale_caches(caches);
+
+        const NNUE::Kernels& kernels = NNUE::kernels();
+        for (int smallNet = 0; smallNet < 2; ++smallNet)
+        {
+            std::size_t        n = netPositions[smallNet].size();
+            std::vector<Value> nnue(n);
+            std::vector<int>   nnueComplexity(n);
+
+            (smallNet ? kernels.evaluate_batch_small : kernels.evaluate_batch_big)(
+              netPositions[smallNet].data(), n, stack, caches, true, nnue.data(), nnueComplexity.data());
+
+            for (std::size_t j = 0; j < n; ++j)
+            {
+                std::size_t i = indices[smallNet][j];
+                values[i]     = scale_nnue(*positions[i], simpleEvals[i], nnue[j], nnueComplexity[j]);
+            }
+        }
+    }
 }  // namespace Stockfish
@@ -19,6 +19,7 @@
 #ifndef EVALUATE_H_INCLUDED
 #define EVALUATE_H_INCLUDED
 
+#include <cstddef>
 #include <string>
 #include <unordered_map>
 
@@ -30,8 +31,18 @@ class Position;
 
 namespace Eval {
 
+namespace NNUE {
+class AccumulatorStack;
+struct AccumulatorCaches;
+}
+
 int   simple_eval(const Position& pos, Color c);
-Value evaluate(const Position& pos);
+Value evaluate(const Position& pos, NNUE::AccumulatorStack& stack, NNUE::AccumulatorCaches& caches);
+void  evaluate_batch(const Position* const    positions[],
+                     std::size_t              count,
+                     Value                    values[],
+                     NNUE::AccumulatorStack&  stack,
+                     NNUE::AccumulatorCaches& caches);
 
 // The default net name MUST follow the format nn-[SHA256 first 12 digits].nnue
 // for the build process (profile-build and fishtest) to work. Do not change the
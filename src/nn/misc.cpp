@@ -61,6 +61,13 @@ using fun8_t = bool (*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGE
     #include <sys/mman.h>
 #endif
 
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) \
   || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) \
   || defined(__e2k__)
@@ -546,6 +553,65 @@ void aligned_large_pages_free(void* mem) { std_aligned_free(mem); }
 #endif
 
 
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::string& filename) {
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            length  = address ? size_t(fileSize.QuadPart) : 0;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+}
+
+MappedFile::~MappedFile() {
+
+    if (address)
+        UnmapViewOfFile(address);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename) {
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* mem = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (mem != MAP_FAILED)
+        {
+            address = mem;
+            length  = size_t(st.st_size);
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+
+    if (address)
+        munmap(address, length);
+}
+
+#endif
+
+
 namespace WinProcGroup {
 
 #ifndef _WIN32
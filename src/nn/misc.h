@@ -48,6 +48,24 @@ void* aligned_large_pages_alloc(size_t size);
 // nop if mem == nullptr
 void aligned_large_pages_free(void* mem);
 
+// Read-only mapping of a whole file. The pages are shared with every other
+// process that maps the same file. data() is nullptr if the file couldn't be
+// mapped.
+class MappedFile {
+   public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return static_cast<const char*>(address); }
+    size_t      size() const { return length; }
+
+   private:
+    void*  address = nullptr;
+    size_t length  = 0;
+};
+
 void dbg_hit_on(bool cond, int slot = 0);
 void dbg_mean_of(int64_t value, int slot = 0);
 void dbg_stdev_of(int64_t value, int slot = 0);
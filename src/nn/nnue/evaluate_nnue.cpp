@@ -20,17 +20,21 @@
 
 #include "evaluate_nnue.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <optional>
 #include <sstream>
 #include <string_view>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include "../evaluate.h"
 #include "../misc.h"
@@ -40,16 +44,78 @@
 #include "nnue_common.h"
 
 namespace Stockfish::Eval::NNUE {
+inline namespace NNUE_ARCH {
 
-// Input feature converter
-LargePagePtr<FeatureTransformer<TransformedFeatureDimensionsBig, &StateInfo::accumulatorBig>>
-  featureTransformerBig;
-LargePagePtr<FeatureTransformer<TransformedFeatureDimensionsSmall, &StateInfo::accumulatorSmall>>
-  featureTransformerSmall;
+// Parameters of a net of width L1 loaded as the given size. Each width has
+// its own, allocated only while a net of that width is loaded.
+template<NetSize Net_Size, IndexType L1>
+struct NetParameters {
+    using Transformer = FeatureTransformer<L1, Net_Size>;
+    using Stack       = NetworkOf<Net_Size, L1>;
 
-// Evaluation function
-AlignedPtr<Network<TransformedFeatureDimensionsBig, L2Big, L3Big>>       networkBig[LayerStacks];
-AlignedPtr<Network<TransformedFeatureDimensionsSmall, L2Small, L3Small>> networkSmall[LayerStacks];
+    static constexpr NetSize   Size  = Net_Size;
+    static constexpr IndexType Width = L1;
+
+    // Input feature converter
+    static inline LargePagePtr<Transformer> featureTransformer;
+
+    // Evaluation function
+    static inline AlignedPtr<Stack> network[LayerStacks];
+};
+
+// Width of the net loaded for each size, 0 if none is
+IndexType netWidth[2];
+
+// Pre-decoded files the parameters of each net size point into, if mapped
+std::unique_ptr<MappedFile> mappedNets[2];
+
+// Calls f with the NetParameters of every width a net of the given size can be
+template<NetSize Net_Size, std::size_t I = 0, typename F>
+static void for_each_width(F&& f) {
+    if constexpr (I < std::size(NetWidths) && NetWidths[I] <= MaxNetWidth<Net_Size>)
+    {
+        f(NetParameters<Net_Size, NetWidths[I]>{});
+        for_each_width<Net_Size, I + 1>(f);
+    }
+}
+
+template<typename F>
+static void for_each_width(NetSize netSize, F&& f) {
+    if (netSize == Small)
+        for_each_width<Small>(f);
+    else
+        for_each_width<Big>(f);
+}
+
+// Calls f with the NetParameters of the net loaded as the given size. The
+// widths are tried in turn, which the branch predictor soon learns, and the
+// widest one is taken when no other matches.
+template<NetSize Net_Size, std::size_t I = 0, typename F>
+static decltype(auto) with_net(F&& f) {
+    constexpr IndexType Width = NetWidths[I];
+    if constexpr (I + 1 < std::size(NetWidths) && NetWidths[I + 1] <= MaxNetWidth<Net_Size>)
+    {
+        if (netWidth[Net_Size] != Width)
+            return with_net<Net_Size, I + 1>(std::forward<F>(f));
+    }
+    return f(NetParameters<Net_Size, Width>{});
+}
+
+template<typename F>
+static decltype(auto) with_net(NetSize netSize, F&& f) {
+    return netSize == Small ? with_net<Small>(f) : with_net<Big>(f);
+}
+
+// Width of the nets of the given size with the given hash value, 0 if none
+static IndexType width_of(NetSize netSize, std::uint32_t hashValue) {
+    IndexType width = 0;
+    for_each_width(netSize, [&](auto net) {
+        using Net = decltype(net);
+        if (hashValue == HashValue<Net::Size, Net::Width>)
+            width = Net::Width;
+    });
+    return width;
+}
 
 // Evaluation function file names
 
@@ -59,7 +125,7 @@ namespace Detail {
 template<typename T>
 void initialize(AlignedPtr<T>& pointer) {
 
-    pointer.reset(reinterpret_cast<T*>(std_aligned_alloc(alignof(T), sizeof(T))));
+    pointer = AlignedPtr<T>(reinterpret_cast<T*>(std_aligned_alloc(alignof(T), sizeof(T))));
     std::memset(pointer.get(), 0, sizeof(T));
 }
 
@@ -68,10 +134,26 @@ void initialize(LargePagePtr<T>& pointer) {
 
     static_assert(alignof(T) <= 4096,
                   "aligned_large_pages_alloc() may fail for such a big alignment requirement of T");
-    pointer.reset(reinterpret_cast<T*>(aligned_large_pages_alloc(sizeof(T))));
+    pointer = LargePagePtr<T>(reinterpret_cast<T*>(aligned_large_pages_alloc(sizeof(T))));
     std::memset(pointer.get(), 0, sizeof(T));
 }
 
+// Point the evaluation function parameters into a mapped file
+template<typename T>
+void map(AlignedPtr<T>& pointer, const char* address) {
+
+    static_assert(alignof(T) <= CacheLineSize);
+    pointer = AlignedPtr<T>(reinterpret_cast<T*>(const_cast<char*>(address)), AlignedDeleter<T>{true});
+}
+
+template<typename T>
+void map(LargePagePtr<T>& pointer, const char* address) {
+
+    static_assert(alignof(T) <= CacheLineSize);
+    pointer =
+      LargePagePtr<T>(reinterpret_cast<T*>(const_cast<char*>(address)), LargePageDeleter<T>{true});
+}
+
 // Read evaluation function parameters
 template<typename T>
 bool read_parameters(std::istream& stream, T& reference) {
@@ -94,21 +176,32 @@ bool write_parameters(std::ostream& stream, const T& reference) {
 }  // namespace Detail
 
 
-// Initialize the evaluation function parameters
-static void initialize(NetSize netSize) {
+// Release the evaluation function parameters of a net size, whatever width
+static void release(NetSize netSize) {
 
-    if (netSize == Small)
-    {
-        Detail::initialize(featureTransformerSmall);
-        for (std::size_t i = 0; i < LayerStacks; ++i)
-            Detail::initialize(networkSmall[i]);
-    }
-    else
-    {
-        Detail::initialize(featureTransformerBig);
-        for (std::size_t i = 0; i < LayerStacks; ++i)
-            Detail::initialize(networkBig[i]);
-    }
+    for_each_width(netSize, [](auto net) {
+        using Net = decltype(net);
+        Net::featureTransformer.reset();
+        for (auto& network : Net::network)
+            network.reset();
+    });
+    netWidth[netSize] = 0;
+    mappedNets[netSize].reset();
+}
+
+// Initialize the evaluation function parameters for a net of the given width
+static void initialize(NetSize netSize, IndexType width) {
+
+    release(netSize);
+    for_each_width(netSize, [&](auto net) {
+        using Net = decltype(net);
+        if (Net::Width != width)
+            return;
+        Detail::initialize(Net::featureTransformer);
+        for (auto& network : Net::network)
+            Detail::initialize(network);
+        netWidth[netSize] = width;
+    });
 }
 
 // Read network header
@@ -137,101 +230,234 @@ static bool write_header(std::ostream& stream, std::uint32_t hashValue, const st
 // Read network parameters
 static bool read_parameters(std::istream& stream, NetSize netSize, std::string& netDescription) {
 
-    std::uint32_t hashValue;
-    if (!read_header(stream, &hashValue, &netDescription))
-        return false;
-    if (hashValue != HashValue[netSize])
-        return false;
-    if (netSize == Big && !Detail::read_parameters(stream, *featureTransformerBig))
-        return false;
-    if (netSize == Small && !Detail::read_parameters(stream, *featureTransformerSmall))
+    std::uint32_t hashValue = 0;
+    const bool    header    = read_header(stream, &hashValue, &netDescription);
+
+    // The hash value tells the width of the net. Without a known one, the
+    // parameters of the widest net of the size are left zeroed.
+    const IndexType width = width_of(netSize, hashValue);
+    initialize(netSize, width ? width : netSize == Small ? MaxNetWidth<Small> : MaxNetWidth<Big>);
+    if (!header || !width)
         return false;
-    for (std::size_t i = 0; i < LayerStacks; ++i)
-    {
-        if (netSize == Big && !Detail::read_parameters(stream, *(networkBig[i])))
-            return false;
-        if (netSize == Small && !Detail::read_parameters(stream, *(networkSmall[i])))
+    return with_net(netSize, [&](auto net) {
+        using Net = decltype(net);
+        if (!Detail::read_parameters(stream, *Net::featureTransformer))
             return false;
-    }
-    return stream && stream.peek() == std::ios::traits_type::eof();
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+            if (!Detail::read_parameters(stream, *Net::network[i]))
+                return false;
+        return stream && stream.peek() == std::ios::traits_type::eof();
+    });
 }
 
 // Write network parameters
 static bool
 write_parameters(std::ostream& stream, NetSize netSize, const std::string& netDescription) {
 
-    if (!write_header(stream, HashValue[netSize], netDescription))
-        return false;
-    if (netSize == Big && !Detail::write_parameters(stream, *featureTransformerBig))
-        return false;
-    if (netSize == Small && !Detail::write_parameters(stream, *featureTransformerSmall))
+    if (!netWidth[netSize])
         return false;
-    for (std::size_t i = 0; i < LayerStacks; ++i)
-    {
-        if (netSize == Big && !Detail::write_parameters(stream, *(networkBig[i])))
+    return with_net(netSize, [&](auto net) {
+        using Net = decltype(net);
+        if (!write_header(stream, HashValue<Net::Size, Net::Width>, netDescription))
             return false;
-        if (netSize == Small && !Detail::write_parameters(stream, *(networkSmall[i])))
+        if (!Detail::write_parameters(stream, *Net::featureTransformer))
             return false;
-    }
-    return bool(stream);
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+            if (!Detail::write_parameters(stream, *Net::network[i]))
+                return false;
+        return bool(stream);
+    });
 }
 
-void hint_common_parent_position(const Position& pos) {
+void hint_common_parent_position(const Position&    pos,
+                                 AccumulatorStack&  stack,
+                                 AccumulatorCaches& caches) {
 
     int simpleEval = simple_eval(pos, pos.side_to_move());
     if (std::abs(simpleEval) > 1050)
-        featureTransformerSmall->hint_common_access(pos);
+        with_net<Small>([&](auto net) {
+            decltype(net)::featureTransformer->hint_common_access(pos, stack, caches.small);
+        });
     else
-        featureTransformerBig->hint_common_access(pos);
+        with_net<Big>([&](auto net) {
+            decltype(net)::featureTransformer->hint_common_access(pos, stack, caches.big);
+        });
 }
 
-// Evaluation function. Perform differential calculation.
+// Combines the materialist (PSQT) and positional parts of the output
+static Value output_value(std::int32_t psqt, std::int32_t positional, bool adjusted, int* complexity) {
+
+    constexpr int delta = 24;
+
+    if (complexity)
+        *complexity = std::abs(psqt - positional) / OutputScale;
+
+    // Give more value to positional evaluation when adjusted flag is set
+    if (adjusted)
+        return static_cast<Value>(((1024 - delta) * psqt + (1024 + delta) * positional)
+                                  / (1024 * OutputScale));
+    else
+        return static_cast<Value>((psqt + positional) / OutputScale);
+}
+
+// The refresh cache of a net size. The two sizes have different types, so
+// it can't be picked with ?: when the call depends on it.
 template<NetSize Net_Size>
-Value evaluate(const Position& pos, bool adjusted, int* complexity) {
+static auto& caches_for(AccumulatorCaches& caches) {
+    if constexpr (Net_Size == Small)
+        return caches.small;
+    else
+        return caches.big;
+}
+
+// Evaluation function. Perform differential calculation.
+template<typename Net>
+static Value evaluate_net(const Position&    pos,
+                          AccumulatorStack&  stack,
+                          AccumulatorCaches& caches,
+                          bool               adjusted,
+                          int*               complexity) {
 
     // We manually align the arrays on the stack because with gcc < 9.3
     // overaligning stack variables with alignas() doesn't work correctly.
 
     constexpr uint64_t alignment = CacheLineSize;
-    constexpr int      delta     = 24;
 
 #if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
     TransformedFeatureType transformedFeaturesUnaligned
-      [FeatureTransformer < Net_Size == Small ? TransformedFeatureDimensionsSmall
-                                              : TransformedFeatureDimensionsBig,
-       nullptr > ::BufferSize + alignment / sizeof(TransformedFeatureType)];
+      [Net::Transformer::BufferSize + alignment / sizeof(TransformedFeatureType)];
 
     auto* transformedFeatures = align_ptr_up<alignment>(&transformedFeaturesUnaligned[0]);
 #else
 
-    alignas(alignment) TransformedFeatureType
-      transformedFeatures[FeatureTransformer < Net_Size == Small ? TransformedFeatureDimensionsSmall
-                                                                 : TransformedFeatureDimensionsBig,
-                          nullptr > ::BufferSize];
+    alignas(alignment) TransformedFeatureType transformedFeatures[Net::Transformer::BufferSize];
 #endif
 
     ASSERT_ALIGNED(transformedFeatures, alignment);
 
-    const int  bucket     = (pos.count<ALL_PIECES>() - 1) / 4;
-    const auto psqt       = Net_Size == Small
-                            ? featureTransformerSmall->transform(pos, transformedFeatures, bucket)
-                            : featureTransformerBig->transform(pos, transformedFeatures, bucket);
-    const auto positional = Net_Size == Small ? networkSmall[bucket]->propagate(transformedFeatures)
-                                              : networkBig[bucket]->propagate(transformedFeatures);
+    // The nonzero blocks of the transformed features are found while they
+    // are written, so fc_0 doesn't have to scan them again
+    typename Net::Transformer::NonZeroOutputs nnz;
 
-    if (complexity)
-        *complexity = std::abs(psqt - positional) / OutputScale;
+    const int  bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+    const auto psqt   = Net::featureTransformer->transform(
+      pos, stack, caches_for<Net::Size>(caches), transformedFeatures, nnz, bucket);
+    const auto positional = Net::network[bucket]->propagate(transformedFeatures, &nnz);
 
-    // Give more value to positional evaluation when adjusted flag is set
-    if (adjusted)
-        return static_cast<Value>(((1024 - delta) * psqt + (1024 + delta) * positional)
-                                  / (1024 * OutputScale));
-    else
-        return static_cast<Value>((psqt + positional) / OutputScale);
+    return output_value(psqt, positional, adjusted, complexity);
+}
+
+template<NetSize Net_Size>
+Value evaluate(const Position&    pos,
+               AccumulatorStack&  stack,
+               AccumulatorCaches& caches,
+               bool               adjusted,
+               int*               complexity) {
+
+    return with_net<Net_Size>([&](auto net) {
+        return evaluate_net<decltype(net)>(pos, stack, caches, adjusted, complexity);
+    });
 }
 
-template Value evaluate<Big>(const Position& pos, bool adjusted, int* complexity);
-template Value evaluate<Small>(const Position& pos, bool adjusted, int* complexity);
+template Value evaluate<Big>(const Position&    pos,
+                             AccumulatorStack&  stack,
+                             AccumulatorCaches& caches,
+                             bool               adjusted,
+                             int*               complexity);
+template Value evaluate<Small>(const Position&    pos,
+                               AccumulatorStack&  stack,
+                               AccumulatorCaches& caches,
+                               bool               adjusted,
+                               int*               complexity);
+
+// Evaluates count unrelated positions, each refreshed from the caches. The
+// positions are transformed BatchSize at a time and then propagated grouped by
+// layer stack bucket, so that the weights of each network stay in cache
+// from one position to the next.
+template<typename Net>
+static void evaluate_batch_net(const Position* const positions[],
+                               std::size_t           count,
+                               AccumulatorStack&     stack,
+                               AccumulatorCaches&    caches,
+                               bool                  adjusted,
+                               Value                 values[],
+                               int                   complexities[]) {
+
+    constexpr std::size_t BatchSize  = 64;
+    constexpr IndexType   BufferSize = Net::Transformer::BufferSize;
+
+    struct Batch {
+        alignas(CacheLineSize) TransformedFeatureType transformedFeatures[BatchSize][BufferSize];
+        typename Net::Transformer::NonZeroOutputs nnz[BatchSize];
+        std::int32_t                              psqt[BatchSize];
+        int                                       bucket[BatchSize];
+    };
+
+    static thread_local AlignedPtr<Batch> batch;
+    if (!batch)
+        Detail::initialize(batch);
+
+    for (std::size_t first = 0; first < count; first += BatchSize)
+    {
+        const std::size_t size = std::min(count - first, BatchSize);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            const Position& pos    = *positions[first + i];
+            const int       bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+
+            stack.reset();
+            batch->bucket[i] = bucket;
+            batch->psqt[i]   = Net::featureTransformer->transform(
+              pos, stack, caches_for<Net::Size>(caches), batch->transformedFeatures[i],
+              batch->nnz[i], bucket);
+        }
+
+        for (IndexType bucket = 0; bucket < LayerStacks; ++bucket)
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                if (batch->bucket[i] != int(bucket))
+                    continue;
+
+                const auto positional = Net::network[bucket]->propagate(
+                  batch->transformedFeatures[i], &batch->nnz[i]);
+
+                values[first + i] =
+                  output_value(batch->psqt[i], positional, adjusted,
+                               complexities ? &complexities[first + i] : nullptr);
+            }
+    }
+}
+
+template<NetSize Net_Size>
+void evaluate_batch(const Position* const positions[],
+                    std::size_t           count,
+                    AccumulatorStack&     stack,
+                    AccumulatorCaches&    caches,
+                    bool                  adjusted,
+                    Value                 values[],
+                    int                   complexities[]) {
+
+    with_net<Net_Size>([&](auto net) {
+        evaluate_batch_net<decltype(net)>(positions, count, stack, caches, adjusted, values,
+                                          complexities);
+    });
+}
+
+template void evaluate_batch<Big>(const Position* const positions[],
+                                  std::size_t           count,
+                                  AccumulatorStack&     stack,
+                                  AccumulatorCaches&    caches,
+                                  bool                  adjusted,
+                                  Value                 values[],
+                                  int                   complexities[]);
+template void evaluate_batch<Small>(const Position* const positions[],
+                                    std::size_t           count,
+                                    AccumulatorStack&     stack,
+                                    AccumulatorCaches&    caches,
+                                    bool                  adjusted,
+                                    Value                 values[],
+                                    int                   complexities[]);
 
 struct NnueEvalTrace {
     static_assert(LayerStacks == PSQTBuckets);
@@ -241,7 +467,9 @@ struct NnueEvalTrace {
     std::size_t correctBucket;
 };
 
-static NnueEvalTrace trace_evaluate(const Position& pos) {
+template<typename Net>
+static NnueEvalTrace
+trace_evaluate(const Position& pos, AccumulatorStack& stack, AccumulatorCaches& caches) {
 
     // We manually align the arrays on the stack because with gcc < 9.3
     // overaligning stack variables with alignas() doesn't work correctly.
@@ -249,13 +477,11 @@ static NnueEvalTrace trace_evaluate(const Position& pos) {
 
 #if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
     TransformedFeatureType transformedFeaturesUnaligned
-      [FeatureTransformer<TransformedFeatureDimensionsBig, nullptr>::BufferSize
-       + alignment / sizeof(TransformedFeatureType)];
+      [Net::Transformer::BufferSize + alignment / sizeof(TransformedFeatureType)];
 
     auto* transformedFeatures = align_ptr_up<alignment>(&transformedFeaturesUnaligned[0]);
 #else
-    alignas(alignment) TransformedFeatureType
-      transformedFeatures[FeatureTransformer<TransformedFeatureDimensionsBig, nullptr>::BufferSize];
+    alignas(alignment) TransformedFeatureType transformedFeatures[Net::Transformer::BufferSize];
 #endif
 
     ASSERT_ALIGNED(transformedFeatures, alignment);
@@ -264,8 +490,9 @@ static NnueEvalTrace trace_evaluate(const Position& pos) {
     t.correctBucket = (pos.count<ALL_PIECES>() - 1) / 4;
     for (IndexType bucket = 0; bucket < LayerStacks; ++bucket)
     {
-        const auto materialist = featureTransformerBig->transform(pos, transformedFeatures, bucket);
-        const auto positional  = networkBig[bucket]->propagate(transformedFeatures);
+        const auto materialist = Net::featureTransformer->transform(
+          pos, stack, caches_for<Net::Size>(caches), transformedFeatures, bucket);
+        const auto positional = Net::network[bucket]->propagate(transformedFeatures);
 
         t.psqt[bucket]       = static_cast<Value>(materialist / OutputScale);
         t.positional[bucket] = static_cast<Value>(positional / OutputScale);
@@ -353,9 +580,15 @@ std::string trace(Position& pos) {
             format_cp_compact(value, &board[y + 2][x + 2]);
     };
 
+    // The trace only looks at this position, so it gets a stack and caches
+    // of its own
+    auto stack  = std::make_unique<AccumulatorStack>();
+    auto caches = std::make_unique<AccumulatorCaches>();
+    stack->reset();
+
     // We estimate the value of each piece by doing a differential evaluation from
     // the current base eval, simulating the removal of the piece from its square.
-    Value base = evaluate<NNUE::Big>(pos);
+    Value base = evaluate<NNUE::Big>(pos, *stack, *caches);
     base       = pos.side_to_move() == WHITE ? base : -base;
 
     for (File f = FILE_A; f <= FILE_H; ++f)
@@ -367,19 +600,15 @@ std::string trace(Position& pos) {
 
             if (pc != NO_PIECE && type_of(pc) != KING)
             {
-                auto st = pos.state();
-
                 pos.remove_piece(sq);
-                st->accumulatorBig.computed[WHITE] = false;
-                st->accumulatorBig.computed[BLACK] = false;
+                stack->reset();
 
-                Value eval = evaluate<NNUE::Big>(pos);
+                Value eval = evaluate<NNUE::Big>(pos, *stack, *caches);
                 eval       = pos.side_to_move() == WHITE ? eval : -eval;
                 v          = base - eval;
 
                 pos.put_piece(pc, sq);
-                st->accumulatorBig.computed[WHITE] = false;
-                st->accumulatorBig.computed[BLACK] = false;
+                stack->reset();
             }
 
             writeSquare(f, r, pc, v);
@@ -390,7 +619,8 @@ std::string trace(Position& pos) {
         ss << board[row] << '\n';
     ss << '\n';
 
-    auto t = trace_evaluate(pos);
+    auto t = with_net<Big>(
+      [&](auto net) { return trace_evaluate<decltype(net)>(pos, *stack, *caches); });
 
     ss << " NNUE network contributions "
        << (pos.side_to_move() == WHITE ? "(White to move)" : "(Black to move)") << std::endl
@@ -426,12 +656,124 @@ std::string trace(Position& pos) {
 // Load eval, from a file stream or a memory stream
 std::optional<std::string> load_eval(std::istream& stream, NetSize netSize) {
 
-    initialize(netSize);
     std::string netDescription;
     return read_parameters(stream, netSize, netDescription) ? std::make_optional(netDescription)
                                                             : std::nullopt;
 }
 
+// Pre-decoded nets start with this header, padded to MappedParametersOffset.
+// The feature transformer and then the network of each layer stack follow,
+// byte for byte as this build keeps them in memory, so they can be used
+// straight from a read-only mapping of the file. The layout depends on the
+// instruction set, which is recorded along with the sizes.
+struct MappedHeader {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t hashValue;
+    char          arch[16];
+    std::uint64_t transformerSize;
+    std::uint64_t networkSize;
+    std::uint32_t descriptionSize;
+};
+
+constexpr char        MappedMagic[8]         = "NNUEMAP";
+constexpr std::size_t MappedParametersOffset = 4096;
+
+// Offset of the network of the first layer stack in the file of a net
+template<typename Net>
+static constexpr std::size_t networks_offset() {
+    return MappedParametersOffset
+         + ceil_to_multiple<std::size_t>(sizeof(typename Net::Transformer), CacheLineSize);
+}
+
+// Map a pre-decoded eval file written by save_mapped_eval. The file is
+// checked against the hash values and memory layout of this build, and the
+// hash value tells the width of the net.
+std::optional<std::string> map_eval(const std::string& filename, NetSize netSize) {
+
+    auto file = std::make_unique<MappedFile>(filename);
+    if (!file->data() || file->size() < MappedParametersOffset)
+        return std::nullopt;
+
+    MappedHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, MappedMagic, sizeof(header.magic)) || header.version != Version
+        || std::strncmp(header.arch, stringify(NNUE_ARCH), sizeof(header.arch))
+        || header.descriptionSize > MappedParametersOffset - sizeof(header))
+        return std::nullopt;
+
+    const IndexType width  = width_of(netSize, header.hashValue);
+    bool            mapped = false;
+    for_each_width(netSize, [&](auto net) {
+        using Net = decltype(net);
+        if (Net::Width != width || header.transformerSize != sizeof(typename Net::Transformer)
+            || header.networkSize != sizeof(typename Net::Stack)
+            || file->size() != networks_offset<Net>() + LayerStacks * sizeof(typename Net::Stack))
+            return;
+
+        release(netSize);
+        const char* data = file->data();
+        Detail::map(Net::featureTransformer, data + MappedParametersOffset);
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+            Detail::map(Net::network[i],
+                        data + networks_offset<Net>() + i * sizeof(typename Net::Stack));
+        netWidth[netSize] = width;
+        mapped            = true;
+    });
+    if (!mapped)
+        return std::nullopt;
+
+    std::string netDescription(file->data() + sizeof(header), header.descriptionSize);
+    mappedNets[netSize] = std::move(file);
+    return netDescription;
+}
+
+// Write the loaded eval as a pre-decoded file for map_eval. The file is
+// written under a temporary name first, so that it is never mapped while
+// incomplete.
+bool save_mapped_eval(const std::string& filename,
+                      NetSize            netSize,
+                      const std::string& netDescription) {
+
+    if (!netWidth[netSize] || netDescription.size() > MappedParametersOffset - sizeof(MappedHeader))
+        return false;
+
+    return with_net(netSize, [&](auto net) {
+        using Net = decltype(net);
+
+        MappedHeader header{};
+        std::memcpy(header.magic, MappedMagic, sizeof(header.magic));
+        header.version   = Version;
+        header.hashValue = HashValue<Net::Size, Net::Width>;
+        std::strncpy(header.arch, stringify(NNUE_ARCH), sizeof(header.arch) - 1);
+        header.transformerSize = sizeof(typename Net::Transformer);
+        header.networkSize     = sizeof(typename Net::Stack);
+        header.descriptionSize = std::uint32_t(netDescription.size());
+
+        std::vector<char> head(networks_offset<Net>());
+        std::memcpy(&head[0], &header, sizeof(header));
+        std::memcpy(&head[sizeof(header)], netDescription.data(), netDescription.size());
+        std::memcpy(&head[MappedParametersOffset], Net::featureTransformer.get(),
+                    sizeof(typename Net::Transformer));
+
+        const std::string tmpName = filename + ".tmp";
+        {
+            std::ofstream stream(tmpName, std::ios::binary);
+            stream.write(head.data(), head.size());
+            for (std::size_t i = 0; i < LayerStacks; ++i)
+                stream.write(reinterpret_cast<const char*>(Net::network[i].get()),
+                             sizeof(typename Net::Stack));
+            if (!stream)
+            {
+                stream.close();
+                std::remove(tmpName.c_str());
+                return false;
+            }
+        }
+        return std::rename(tmpName.c_str(), filename.c_str()) == 0;
+    });
+}
+
 // Save eval, to a file stream or a memory stream
 bool save_eval(std::ostream&      stream,
                NetSize            netSize,
@@ -479,4 +821,20 @@ bool save_eval(const std::optional<std::string>&                              fi
 }
 
 
+const Kernels ArchKernels = {
+  NNUE_ARCH_NAME,
+  stringify(NNUE_ARCH),
+  evaluate<Big>,
+  evaluate<Small>,
+  evaluate_batch<Big>,
+  evaluate_batch<Small>,
+  hint_common_parent_position,
+  trace,
+  load_eval,
+  save_eval,
+  map_eval,
+  save_mapped_eval,
+};
+
+}  // inline namespace NNUE_ARCH
 }  // namespace Stockfish::Eval::NNUE
@@ -21,6 +21,7 @@
 #ifndef NNUE_EVALUATE_NNUE_H_INCLUDED
 #define NNUE_EVALUATE_NNUE_H_INCLUDED
 
+#include <cstddef>
 #include <cstdint>
 #include <iosfwd>
 #include <memory>
@@ -31,6 +32,7 @@
 #include "../misc.h"
 #include "../types.h"
 #include "nnue_architecture.h"
+#include "nnue_dispatch.h"
 #include "nnue_feature_transformer.h"
 
 namespace Stockfish {
@@ -44,17 +46,21 @@ struct EvalFile;
 
 namespace Stockfish::Eval::NNUE {
 
-// Hash value of evaluation function structure
-constexpr std::uint32_t HashValue[2] = {
-  FeatureTransformer<TransformedFeatureDimensionsBig, nullptr>::get_hash_value()
-    ^ Network<TransformedFeatureDimensionsBig, L2Big, L3Big>::get_hash_value(),
-  FeatureTransformer<TransformedFeatureDimensionsSmall, nullptr>::get_hash_value()
-    ^ Network<TransformedFeatureDimensionsSmall, L2Small, L3Small>::get_hash_value()};
+// Hash value of evaluation function structure, for a net of width L1 loaded
+// as the given size
+template<NetSize Net_Size, IndexType L1>
+constexpr std::uint32_t HashValue =
+  FeatureTransformer<L1, Net_Size>::get_hash_value() ^ NetworkOf<Net_Size, L1>::get_hash_value();
 
-// Deleter for automating release of memory area
+// Deleter for automating release of memory area. Parameters that point into
+// a mapped file (see map_eval) belong to the mapping and aren't freed.
 template<typename T>
 struct AlignedDeleter {
+    bool mapped = false;
+
     void operator()(T* ptr) const {
+        if (mapped)
+            return;
         ptr->~T();
         std_aligned_free(ptr);
     }
@@ -62,7 +68,11 @@ struct AlignedDeleter {
 
 template<typename T>
 struct LargePageDeleter {
+    bool mapped = false;
+
     void operator()(T* ptr) const {
+        if (mapped)
+            return;
         ptr->~T();
         aligned_large_pages_free(ptr);
     }
@@ -74,12 +84,34 @@ using AlignedPtr = std::unique_ptr<T, AlignedDeleter<T>>;
 template<typename T>
 using LargePagePtr = std::unique_ptr<T, LargePageDeleter<T>>;
 
+// Built once per instruction set, the rest of the engine goes through the
+// Kernels table of the build selected at runtime (see nnue_dispatch.h)
+inline namespace NNUE_ARCH {
+
 std::string trace(Position& pos);
 template<NetSize Net_Size>
-Value evaluate(const Position& pos, bool adjusted = false, int* complexity = nullptr);
-void  hint_common_parent_position(const Position& pos);
+Value evaluate(const Position&    pos,
+               AccumulatorStack&  stack,
+               AccumulatorCaches& caches,
+               bool               adjusted   = false,
+               int*               complexity = nullptr);
+template<NetSize Net_Size>
+void  evaluate_batch(const Position* const positions[],
+                     std::size_t           count,
+                     AccumulatorStack&     stack,
+                     AccumulatorCaches&    caches,
+                     bool                  adjusted,
+                     Value                 values[],
+                     int                   complexities[] = nullptr);
+void  hint_common_parent_position(const Position&    pos,
+                                  AccumulatorStack&  stack,
+                                  AccumulatorCaches& caches);
 
 std::optional<std::string> load_eval(std::istream& stream, NetSize netSize);
+std::optional<std::string> map_eval(const std::string& filename, NetSize netSize);
+bool                       save_mapped_eval(const std::string& filename,
+                                            NetSize            netSize,
+                                            const std::string& netDescription);
 bool                       save_eval(std::ostream&      stream,
                                      NetSize            netSize,
                                      const std::string& name,
@@ -88,6 +120,11 @@ bool                       save_eval(const std::optional<std::string>& filename,
                                      NetSize                           netSize,
                                      const std::unordered_map<Eval::NNUE::NetSize, Eval::EvalFile>&);
 
+// Entry points of this build
+extern const Kernels ArchKernels;
+
+}  // inline namespace NNUE_ARCH
+
 }  // namespace Stockfish::Eval::NNUE
 
 #endif  // #ifndef NNUE_EVALUATE_NNUE_H_INCLUDED
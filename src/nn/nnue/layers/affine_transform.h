@@ -38,6 +38,7 @@
 */
 
 namespace Stockfish::Eval::NNUE::Layers {
+inline namespace NNUE_ARCH {
 
 // Fallback implementation for older/other architectures.
 // Requires the input to be padded to at least 16 values.
@@ -303,6 +304,7 @@ class AffineTransform {
     alignas(CacheLineSize) WeightType weights[OutputDimensions * PaddedInputDimensions];
 };
 
+}  // inline namespace NNUE_ARCH
 }  // namespace Stockfish::Eval::NNUE::Layers
 
 #endif  // #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
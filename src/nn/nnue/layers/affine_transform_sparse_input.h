@@ -24,7 +24,10 @@
 #include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <vector>
 
 #include "../../bitboard.h"
 #include "../nnue_common.h"
@@ -36,6 +39,7 @@
 */
 
 namespace Stockfish::Eval::NNUE::Layers {
+inline namespace NNUE_ARCH {
 
 #if (USE_SSSE3 | (USE_NEON >= 8))
 alignas(CacheLineSize) static inline const
@@ -50,44 +54,46 @@ alignas(CacheLineSize) static inline const
       return v;
   }();
 
-// Find indices of nonzero numbers in an int32_t array
-template<const IndexType InputDimensions>
-void find_nnz(const std::int32_t* input, std::uint16_t* out, IndexType& count_out) {
-    #if defined(USE_SSSE3)
-        #if defined(USE_AVX512)
-    using vec_t = __m512i;
-            #define vec_nnz(a) _mm512_cmpgt_epi32_mask(a, _mm512_setzero_si512())
-        #elif defined(USE_AVX2)
-    using vec_t = __m256i;
-            #if defined(USE_VNNI) && !defined(USE_AVXVNNI)
-                #define vec_nnz(a) _mm256_cmpgt_epi32_mask(a, _mm256_setzero_si256())
-            #else
-                #define vec_nnz(a) \
-                    _mm256_movemask_ps( \
-                      _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, _mm256_setzero_si256())))
-            #endif
-        #elif defined(USE_SSSE3)
-    using vec_t = __m128i;
+#if defined(USE_SSSE3)
+    #if defined(USE_AVX512)
+using nnz_vec_t = __m512i;
+        #define vec_nnz(a) _mm512_cmpgt_epi32_mask(a, _mm512_setzero_si512())
+    #elif defined(USE_AVX2)
+using nnz_vec_t = __m256i;
+        #if defined(USE_VNNI) && !defined(USE_AVXVNNI)
+            #define vec_nnz(a) _mm256_cmpgt_epi32_mask(a, _mm256_setzero_si256())
+        #else
             #define vec_nnz(a) \
-                _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, _mm_setzero_si128())))
+                _mm256_movemask_ps( \
+                  _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, _mm256_setzero_si256())))
         #endif
-    using vec128_t = __m128i;
-        #define vec128_zero _mm_setzero_si128()
-        #define vec128_set_16(a) _mm_set1_epi16(a)
-        #define vec128_load(a) _mm_load_si128(a)
-        #define vec128_storeu(a, b) _mm_storeu_si128(a, b)
-        #define vec128_add(a, b) _mm_add_epi16(a, b)
-    #elif defined(USE_NEON)
-    using vec_t                        = uint32x4_t;
-    static const std::uint32_t Mask[4] = {1, 2, 4, 8};
-        #define vec_nnz(a) vaddvq_u32(vandq_u32(vtstq_u32(a, a), vld1q_u32(Mask)))
-    using vec128_t                     = uint16x8_t;
-        #define vec128_zero vdupq_n_u16(0)
-        #define vec128_set_16(a) vdupq_n_u16(a)
-        #define vec128_load(a) vld1q_u16(reinterpret_cast<const std::uint16_t*>(a))
-        #define vec128_storeu(a, b) vst1q_u16(reinterpret_cast<std::uint16_t*>(a), b)
-        #define vec128_add(a, b) vaddq_u16(a, b)
+    #elif defined(USE_SSSE3)
+using nnz_vec_t = __m128i;
+        #define vec_nnz(a) \
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, _mm_setzero_si128())))
     #endif
+using vec128_t = __m128i;
+    #define vec128_zero _mm_setzero_si128()
+    #define vec128_set_16(a) _mm_set1_epi16(a)
+    #define vec128_load(a) _mm_load_si128(a)
+    #define vec128_storeu(a, b) _mm_storeu_si128(a, b)
+    #define vec128_add(a, b) _mm_add_epi16(a, b)
+#elif defined(USE_NEON)
+using nnz_vec_t = uint32x4_t;
+static inline const std::uint32_t NnzMask[4] = {1, 2, 4, 8};
+    #define vec_nnz(a) vaddvq_u32(vandq_u32(vtstq_u32(a, a), vld1q_u32(NnzMask)))
+using vec128_t = uint16x8_t;
+    #define vec128_zero vdupq_n_u16(0)
+    #define vec128_set_16(a) vdupq_n_u16(a)
+    #define vec128_load(a) vld1q_u16(reinterpret_cast<const std::uint16_t*>(a))
+    #define vec128_storeu(a, b) vst1q_u16(reinterpret_cast<std::uint16_t*>(a), b)
+    #define vec128_add(a, b) vaddq_u16(a, b)
+#endif
+
+// Find indices of nonzero numbers in an int32_t array
+template<const IndexType InputDimensions>
+void find_nnz(const std::int32_t* input, std::uint16_t* out, IndexType& count_out) {
+    using vec_t                        = nnz_vec_t;
     constexpr IndexType InputSimdWidth = sizeof(vec_t) / sizeof(std::int32_t);
     // Inputs are processed InputSimdWidth at a time and outputs are processed 8 at a time so we process in chunks of max(InputSimdWidth, 8)
     constexpr IndexType ChunkSize       = std::max<IndexType>(InputSimdWidth, 8);
@@ -120,6 +126,32 @@ void find_nnz(const std::int32_t* input, std::uint16_t* out, IndexType& count_ou
     }
     count_out = count;
 }
+
+// Same as find_nnz for a single vector of the input, whose first int32_t has
+// index base, while the input is being written. The indices are appended to
+// out, up to 8 entries past the new count may be overwritten.
+template<typename InputVector>
+inline void
+append_nnz(const InputVector& input, IndexType base, std::uint16_t* out, IndexType& count) {
+    static_assert(sizeof(InputVector) == sizeof(nnz_vec_t));
+    constexpr IndexType InputSimdWidth = sizeof(nnz_vec_t) / sizeof(std::int32_t);
+
+    nnz_vec_t inputChunk;
+    std::memcpy(&inputChunk, &input, sizeof(inputChunk));
+    const unsigned nnz = vec_nnz(inputChunk);
+
+    vec128_t       offset    = vec128_set_16(base);
+    const vec128_t increment = vec128_set_16(8);
+    for (IndexType j = 0; j < InputSimdWidth; j += 8)
+    {
+        const auto lookup = (nnz >> j) & 0xFF;
+        const auto offsets =
+          vec128_load(reinterpret_cast<const vec128_t*>(&lookup_indices[lookup]));
+        vec128_storeu(reinterpret_cast<vec128_t*>(out + count), vec128_add(offset, offsets));
+        count += popcount(lookup);
+        offset = vec128_add(offset, increment);
+    }
+}
     #undef vec_nnz
     #undef vec128_zero
     #undef vec128_set_16
@@ -128,6 +160,16 @@ void find_nnz(const std::int32_t* input, std::uint16_t* out, IndexType& count_ou
     #undef vec128_add
 #endif
 
+// Indices of the nonzero 32-bit chunks of an input of InputDimensions bytes,
+// in increasing order. FeatureTransformer::transform can collect them while
+// it writes its output, which spares fc_0 a second pass over it.
+template<IndexType InputDimensions>
+struct NonZeroChunks {
+    // Indices are stored 8 at a time, hence the room for 8 more
+    std::uint16_t indices[ceil_to_multiple<IndexType>(InputDimensions, 32) / 4 + 8];
+    IndexType     count;
+};
+
 // Sparse input implementation
 template<IndexType InDims, IndexType OutDims>
 class AffineTransformSparseInput {
@@ -196,9 +238,43 @@ class AffineTransformSparseInput {
 
         return !stream.fail();
     }
+
+    // Reorders the inputs: input i becomes what input order[i] was
+    void permute_inputs(const IndexType* order) {
+        const std::vector<WeightType> original(std::begin(weights), std::end(weights));
+        for (IndexType o = 0; o < OutputDimensions; ++o)
+            for (IndexType i = 0; i < InputDimensions; ++i)
+                weights[get_weight_index(o * PaddedInputDimensions + i)] =
+                  original[get_weight_index(o * PaddedInputDimensions + order[i])];
+    }
+
+    // Indices of the nonzero chunks of an input
+    using NonZeroInputs = NonZeroChunks<InputDimensions>;
+
     // Forward propagation
     void propagate(const InputType* input, OutputType* output) const {
 
+#if (USE_SSSE3 | (USE_NEON >= 8))
+        constexpr IndexType NumChunks = ceil_to_multiple<IndexType>(InputDimensions, 8) / ChunkSize;
+        NonZeroInputs       nnz;
+
+        // Find indices of nonzero 32-bit blocks
+        find_nnz<NumChunks>(reinterpret_cast<const std::int32_t*>(input), nnz.indices, nnz.count);
+
+        propagate(input, nnz, output);
+#else
+        // Use dense implementation for the other architectures.
+        affine_transform_non_ssse3<InputDimensions, PaddedInputDimensions, OutputDimensions>(
+          output, weights, biases, input);
+#endif
+    }
+
+    // Forward propagation with the nonzero 32-bit blocks of the input already
+    // known, e.g. from FeatureTransformer::transform
+    void propagate(const InputType*                      input,
+                   [[maybe_unused]] const NonZeroInputs& nnz,
+                   OutputType*                           output) const {
+
 #if (USE_SSSE3 | (USE_NEON >= 8))
     #if defined(USE_AVX512)
         using invec_t  = __m512i;
@@ -228,24 +304,18 @@ class AffineTransformSparseInput {
     #endif
         static constexpr IndexType OutputSimdWidth = sizeof(outvec_t) / sizeof(OutputType);
 
-        constexpr IndexType NumChunks = ceil_to_multiple<IndexType>(InputDimensions, 8) / ChunkSize;
-        constexpr IndexType NumRegs   = OutputDimensions / OutputSimdWidth;
-        std::uint16_t       nnz[NumChunks];
-        IndexType           count;
+        constexpr IndexType NumRegs = OutputDimensions / OutputSimdWidth;
 
         const auto input32 = reinterpret_cast<const std::int32_t*>(input);
 
-        // Find indices of nonzero 32-bit blocks
-        find_nnz<NumChunks>(input32, nnz, count);
-
         const outvec_t* biasvec = reinterpret_cast<const outvec_t*>(biases);
         outvec_t        acc[NumRegs];
         for (IndexType k = 0; k < NumRegs; ++k)
             acc[k] = biasvec[k];
 
-        for (IndexType j = 0; j < count; ++j)
+        for (IndexType j = 0; j < nnz.count; ++j)
         {
-            const auto    i  = nnz[j];
+            const auto    i  = nnz.indices[j];
             const invec_t in = vec_set_32(input32[i]);
             const auto    col =
               reinterpret_cast<const invec_t*>(&weights[i * OutputDimensions * ChunkSize]);
@@ -273,6 +343,7 @@ class AffineTransformSparseInput {
     alignas(CacheLineSize) WeightType weights[OutputDimensions * PaddedInputDimensions];
 };
 
+}  // inline namespace NNUE_ARCH
 }  // namespace Stockfish::Eval::NNUE::Layers
 
 #endif  // #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_SPARSE_INPUT_H_INCLUDED
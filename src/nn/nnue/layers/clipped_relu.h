@@ -28,6 +28,7 @@
 #include "../nnue_common.h"
 
 namespace Stockfish::Eval::NNUE::Layers {
+inline namespace NNUE_ARCH {
 
 // Clipped ReLU
 template<IndexType InDims>
@@ -163,6 +164,7 @@ class ClippedReLU {
     }
 };
 
+}  // inline namespace NNUE_ARCH
 }  // namespace Stockfish::Eval::NNUE::Layers
 
 #endif  // NNUE_LAYERS_CLIPPED_RELU_H_INCLUDED
@@ -35,7 +35,10 @@
     #include <arm_neon.h>
 #endif
 
+#include "../nnue_common.h"
+
 namespace Stockfish::Simd {
+inline namespace NNUE_ARCH {
 
 #if defined(USE_AVX512)
 
@@ -162,6 +165,7 @@ dotprod_m128_add_dpbusd_epi32(int32x4_t& acc, int8x16_t a, int8x16_t b) {
     acc                = vpadalq_s16(acc, sum);
 }
 #endif
+}  // inline namespace NNUE_ARCH
 }
 
 #endif  // STOCKFISH_SIMD_H_INCLUDED
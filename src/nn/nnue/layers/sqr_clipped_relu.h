@@ -28,6 +28,7 @@
 #include "../nnue_common.h"
 
 namespace Stockfish::Eval::NNUE::Layers {
+inline namespace NNUE_ARCH {
 
 // Clipped ReLU
 template<IndexType InDims>
@@ -98,6 +99,7 @@ class SqrClippedReLU {
     }
 };
 
+}  // inline namespace NNUE_ARCH
 }  // namespace Stockfish::Eval::NNUE::Layers
 
 #endif  // NNUE_LAYERS_SQR_CLIPPED_RELU_H_INCLUDED
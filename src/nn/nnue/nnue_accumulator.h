@@ -21,8 +21,12 @@
 #ifndef NNUE_ACCUMULATOR_H_INCLUDED
 #define NNUE_ACCUMULATOR_H_INCLUDED
 
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 
+#include "../types.h"
 #include "nnue_architecture.h"
 #include "nnue_common.h"
 
@@ -36,6 +40,120 @@ struct alignas(CacheLineSize) Accumulator {
     bool         computed[2];
 };
 
+// Accumulators of one position for both nets, each as wide as the widest net
+// of its size, together with the pieces changed by the move that led to it
+struct AccumulatorState {
+    Accumulator<TransformedFeatureDimensionsBig>   accumulatorBig;
+    Accumulator<TransformedFeatureDimensionsSmall> accumulatorSmall;
+    DirtyPiece                                     dirtyPiece;
+
+    void reset() {
+        accumulatorBig.computed[WHITE]   = false;
+        accumulatorBig.computed[BLACK]   = false;
+        accumulatorSmall.computed[WHITE] = false;
+        accumulatorSmall.computed[BLACK] = false;
+    }
+};
+
+// Accumulator of AccumulatorState that a net of the given size uses
+template<NetSize Net_Size>
+constexpr auto accumulator_of() {
+    if constexpr (Net_Size == Small)
+        return &AccumulatorState::accumulatorSmall;
+    else
+        return &AccumulatorState::accumulatorBig;
+}
+
+// Preallocated stack of accumulator states indexed by ply, the root
+// position's at the bottom. Looking for an earlier computed accumulator
+// walks down contiguous memory instead of following StateInfo pointers.
+// Each thread needs its own.
+class AccumulatorStack {
+   public:
+    static constexpr std::size_t MaxSize = MAX_PLY + 1;
+
+    AccumulatorState& root() { return states[0]; }
+    AccumulatorState& latest() { return states[size - 1]; }
+
+    // Starts over from a new root position
+    void reset() {
+        size = 1;
+        states[0].reset();
+    }
+
+    // Adds the state of the position reached by a move that changed dp
+    void push(const DirtyPiece& dp) {
+        assert(size < MaxSize);
+        states[size].reset();
+        states[size].dirtyPiece = dp;
+        ++size;
+    }
+
+    void pop() {
+        assert(size > 1);
+        --size;
+    }
+
+   private:
+    AccumulatorState states[MaxSize];
+    std::size_t      size = 1;
+};
+
+// Refresh cache, a.k.a. "Finny tables". For every king square and
+// perspective it keeps the accumulator of the last position refreshed with
+// the king there, together with that position's pieces. A refresh then only
+// applies the difference between the cached board and the current one
+// instead of adding up every active feature. Each thread needs its own.
+struct AccumulatorCaches {
+
+    template<IndexType Size>
+    struct alignas(CacheLineSize) Cache {
+
+        struct alignas(CacheLineSize) Entry {
+            std::int16_t accumulation[Size];
+            std::int32_t psqtAccumulation[PSQTBuckets];
+            Bitboard     byColorBB[COLOR_NB];
+            Bitboard     byTypeBB[PIECE_TYPE_NB];
+            // Entries are set to the empty board on first use, as the
+            // biases aren't known before the net is loaded
+            bool initialized = false;
+
+            // The accumulator of an empty board is just the biases, of
+            // which a net narrower than Size has fewer
+            void clear(const std::int16_t* biases, IndexType dimensions) {
+                assert(dimensions <= Size);
+                std::memcpy(accumulation, biases, dimensions * sizeof(std::int16_t));
+                std::memset(psqtAccumulation, 0, sizeof(psqtAccumulation));
+                std::memset(byColorBB, 0, sizeof(byColorBB));
+                std::memset(byTypeBB, 0, sizeof(byTypeBB));
+                initialized = true;
+            }
+        };
+
+        Entry entries[SQUARE_NB][COLOR_NB];
+
+        Entry& entry(Square ksq, Color perspective) { return entries[ksq][perspective]; }
+
+        void clear() {
+            for (auto& square : entries)
+                for (auto& entry : square)
+                    entry.initialized = false;
+        }
+    };
+
+    Cache<TransformedFeatureDimensionsBig>   big;
+    Cache<TransformedFeatureDimensionsSmall> small;
+
+    // Number of net loads the entries were built with. Eval::evaluate
+    // clears the caches when a net was loaded since.
+    std::uint64_t netGeneration = 0;
+
+    void clear() {
+        big.clear();
+        small.clear();
+    }
+};
+
 }  // namespace Stockfish::Eval::NNUE
 
 #endif  // NNUE_ACCUMULATOR_H_INCLUDED
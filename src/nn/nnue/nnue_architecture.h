@@ -42,7 +42,9 @@ enum NetSize : int {
     Small
 };
 
-// Number of input feature dimensions after conversion
+// Number of input feature dimensions after conversion, at most. A net of
+// either size may be any width of NetWidths up to this, as told by the hash
+// value in its header.
 constexpr IndexType TransformedFeatureDimensionsBig = 2560;
 constexpr int       L2Big                           = 15;
 constexpr int       L3Big                           = 32;
@@ -54,6 +56,26 @@ constexpr int       L3Small                           = 32;
 constexpr IndexType PSQTBuckets = 8;
 constexpr IndexType LayerStacks = 8;
 
+// Widths (L1) that the feature transformer and networks are built for, in
+// increasing order
+constexpr IndexType NetWidths[] = {128, 256, 512, 1024, 2560};
+
+template<NetSize Net_Size>
+constexpr IndexType MaxNetWidth =
+  Net_Size == Small ? TransformedFeatureDimensionsSmall : TransformedFeatureDimensionsBig;
+
+constexpr bool is_net_width(IndexType width) {
+    for (IndexType w : NetWidths)
+        if (w == width)
+            return true;
+    return false;
+}
+
+static_assert(is_net_width(MaxNetWidth<Big>) && is_net_width(MaxNetWidth<Small>),
+              "The widest net of each size must be one of NetWidths");
+
+inline namespace NNUE_ARCH {
+
 template<IndexType L1, int L2, int L3>
 struct Network {
     static constexpr IndexType TransformedFeatureDimensions = L1;
@@ -96,7 +118,21 @@ struct Network {
             && fc_2.write_parameters(stream);
     }
 
+    // Reorders the transformed features read by the network: input i
+    // becomes what input order[i] was (see FeatureTransformer::permute_outputs)
+    void permute_inputs(const IndexType* order) { fc_0.permute_inputs(order); }
+
+    // Nonzero 32-bit blocks of the transformed features
+    using NonZeroInputs = typename decltype(fc_0)::NonZeroInputs;
+
     std::int32_t propagate(const TransformedFeatureType* transformedFeatures) {
+        return propagate(transformedFeatures, nullptr);
+    }
+
+    // With nnz, the nonzero blocks collected by FeatureTransformer::transform,
+    // fc_0 doesn't have to scan the transformed features for them again
+    std::int32_t propagate(const TransformedFeatureType* transformedFeatures,
+                           const NonZeroInputs*          nnz) {
         struct alignas(CacheLineSize) Buffer {
             alignas(CacheLineSize) typename decltype(fc_0)::OutputBuffer fc_0_out;
             alignas(CacheLineSize) typename decltype(ac_sqr_0)::OutputType
@@ -118,7 +154,10 @@ struct Network {
         alignas(CacheLineSize) static thread_local Buffer buffer;
 #endif
 
-        fc_0.propagate(transformedFeatures, buffer.fc_0_out);
+        if (nnz)
+            fc_0.propagate(transformedFeatures, *nnz, buffer.fc_0_out);
+        else
+            fc_0.propagate(transformedFeatures, buffer.fc_0_out);
         ac_sqr_0.propagate(buffer.fc_0_out, buffer.ac_sqr_0_out);
         ac_0.propagate(buffer.fc_0_out, buffer.ac_0_out);
         std::memcpy(buffer.ac_sqr_0_out + FC_0_OUTPUTS, buffer.ac_0_out,
@@ -137,6 +176,13 @@ struct Network {
     }
 };
 
+// Network of a net of width L1 loaded as the given size
+template<NetSize Net_Size, IndexType L1>
+using NetworkOf =
+  Network<L1, Net_Size == Small ? L2Small : L2Big, Net_Size == Small ? L3Small : L3Big>;
+
+}  // inline namespace NNUE_ARCH
+
 }  // namespace Stockfish::Eval::NNUE
 
 #endif  // #ifndef NNUE_ARCHITECTURE_H_INCLUDED
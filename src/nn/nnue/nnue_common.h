@@ -46,6 +46,59 @@
     #include <arm_neon.h>
 #endif
 
+// Name of the namespace holding the code built for the instruction set
+// enabled by the USE_* flags, and a readable name for reports. One binary
+// can link the kernels built for several instruction sets (see
+// nnue_dispatch.h), so everything that depends on the flags lives in this
+// inline namespace and each build keeps its own copy at link time.
+#if defined(USE_AVX512) && defined(USE_VNNI)
+    #define NNUE_ISA Avx512Vnni
+    #define NNUE_ISA_NAME "AVX-512 VNNI"
+#elif defined(USE_AVX512)
+    #define NNUE_ISA Avx512
+    #define NNUE_ISA_NAME "AVX-512"
+#elif defined(USE_AVXVNNI)
+    #define NNUE_ISA AvxVnni
+    #define NNUE_ISA_NAME "AVX-VNNI"
+#elif defined(USE_AVX2) && defined(USE_VNNI)
+    #define NNUE_ISA Vnni256
+    #define NNUE_ISA_NAME "AVX-512 VNNI (256-bit)"
+#elif defined(USE_AVX2)
+    #define NNUE_ISA Avx2
+    #define NNUE_ISA_NAME "AVX2"
+#elif defined(USE_SSE41)
+    #define NNUE_ISA Sse41
+    #define NNUE_ISA_NAME "SSE4.1"
+#elif defined(USE_SSSE3)
+    #define NNUE_ISA Ssse3
+    #define NNUE_ISA_NAME "SSSE3"
+#elif defined(USE_SSE2)
+    #define NNUE_ISA Sse2
+    #define NNUE_ISA_NAME "SSE2"
+#elif defined(USE_NEON)
+    #define NNUE_ISA Neon
+    #define NNUE_ISA_NAME "NEON"
+#else
+    #define NNUE_ISA Generic
+    #define NNUE_ISA_NAME "generic"
+#endif
+
+// Builds whose feature transformer keeps int8 weights (NNUE_INT8_WEIGHTS, see
+// nnue_feature_transformer.h) add Int8 to the namespace, e.g. Avx2Int8, so
+// they can be linked next to the int16 build of the same instruction set.
+#define NNUE_INT8_ARCH(isa) NNUE_INT8_ARCH_(isa)
+#define NNUE_INT8_ARCH_(isa) isa##Int8
+
+#if defined(NNUE_INT8_WEIGHTS)
+    #define NNUE_WEIGHTS_ARCH(isa) NNUE_INT8_ARCH(isa)
+    #define NNUE_ARCH_NAME NNUE_ISA_NAME " (int8 weights)"
+#else
+    #define NNUE_WEIGHTS_ARCH(isa) isa
+    #define NNUE_ARCH_NAME NNUE_ISA_NAME
+#endif
+
+#define NNUE_ARCH NNUE_WEIGHTS_ARCH(NNUE_ISA)
+
 namespace Stockfish::Eval::NNUE {
 
 // Version of the evaluation file
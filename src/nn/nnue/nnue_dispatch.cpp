@@ -0,0 +1,87 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runtime selection of the NNUE evaluation kernels
+
+#include "nnue_dispatch.h"
+
+#include "nnue_common.h"
+
+namespace Stockfish::Eval::NNUE {
+
+// With NNUE_MULTI_ARCH the binary links evaluate_nnue.cpp built for each of
+// the x86 instruction sets below (see the Makefile), all with the same
+// feature transformer weights, int16 or int8. Otherwise only the build for
+// the flags this file is compiled with is linked.
+#if defined(NNUE_MULTI_ARCH)
+namespace NNUE_WEIGHTS_ARCH(Avx512Vnni) {
+extern const Kernels ArchKernels;
+}
+namespace NNUE_WEIGHTS_ARCH(AvxVnni) {
+extern const Kernels ArchKernels;
+}
+namespace NNUE_WEIGHTS_ARCH(Avx2) {
+extern const Kernels ArchKernels;
+}
+namespace NNUE_WEIGHTS_ARCH(Sse41) {
+extern const Kernels ArchKernels;
+}
+namespace NNUE_WEIGHTS_ARCH(Generic) {
+extern const Kernels ArchKernels;
+}
+#else
+inline namespace NNUE_ARCH {
+extern const Kernels ArchKernels;
+}
+#endif
+
+namespace {
+
+const Kernels& select_kernels() {
+
+#if defined(NNUE_MULTI_ARCH)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("avx512vnni"))
+        return NNUE_WEIGHTS_ARCH(Avx512Vnni)::ArchKernels;
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("avxvnni"))
+        return NNUE_WEIGHTS_ARCH(AvxVnni)::ArchKernels;
+
+    if (__builtin_cpu_supports("avx2"))
+        return NNUE_WEIGHTS_ARCH(Avx2)::ArchKernels;
+
+    if (__builtin_cpu_supports("sse4.1"))
+        return NNUE_WEIGHTS_ARCH(Sse41)::ArchKernels;
+
+    return NNUE_WEIGHTS_ARCH(Generic)::ArchKernels;
+#else
+    return ArchKernels;
+#endif
+}
+
+}  // namespace
+
+const Kernels& kernels() {
+    static const Kernels& selected = select_kernels();
+    return selected;
+}
+
+}  // namespace Stockfish::Eval::NNUE
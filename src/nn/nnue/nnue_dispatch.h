@@ -0,0 +1,74 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runtime selection of the NNUE evaluation kernels
+
+#ifndef NNUE_DISPATCH_H_INCLUDED
+#define NNUE_DISPATCH_H_INCLUDED
+
+#include <cstddef>
+#include <iosfwd>
+#include <optional>
+#include <string>
+
+#include "../types.h"
+
+namespace Stockfish {
+class Position;
+}
+
+namespace Stockfish::Eval::NNUE {
+
+enum NetSize : int;
+class AccumulatorStack;
+struct AccumulatorCaches;
+
+// Entry points of one build of the evaluation code. evaluate_nnue.cpp can be
+// compiled once per instruction set into the same binary, each build in its
+// own namespace (see NNUE_ARCH in nnue_common.h) with its own table.
+struct Kernels {
+    const char* name;
+    // Short name used in the names of pre-decoded net files
+    const char* tag;
+
+    Value (*evaluate_big)(const Position&, AccumulatorStack&, AccumulatorCaches&, bool, int*);
+    Value (*evaluate_small)(const Position&, AccumulatorStack&, AccumulatorCaches&, bool, int*);
+    void (*evaluate_batch_big)(
+      const Position* const*, std::size_t, AccumulatorStack&, AccumulatorCaches&, bool, Value*, int*);
+    void (*evaluate_batch_small)(
+      const Position* const*, std::size_t, AccumulatorStack&, AccumulatorCaches&, bool, Value*, int*);
+    void (*hint_common_parent_position)(const Position&, AccumulatorStack&, AccumulatorCaches&);
+    std::string (*trace)(Position&);
+
+    std::optional<std::string> (*load_eval)(std::istream&, NetSize);
+    bool (*save_eval)(std::ostream&, NetSize, const std::string&, const std::string&);
+
+    // Pre-decoded nets, stored in the exact memory layout of this build so
+    // that they can be mapped instead of decoded
+    std::optional<std::string> (*map_eval)(const std::string&, NetSize);
+    bool (*save_mapped_eval)(const std::string&, NetSize, const std::string&);
+};
+
+// The kernels for the best instruction set that both the CPU and the binary
+// support, chosen with cpuid on first use. Networks are loaded into the
+// selected build's weights, so the choice never changes afterwards.
+const Kernels& kernels();
+
+}  // namespace Stockfish::Eval::NNUE
+
+#endif  // #ifndef NNUE_DISPATCH_H_INCLUDED
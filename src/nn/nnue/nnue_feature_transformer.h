@@ -24,8 +24,10 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <iosfwd>
+#include <memory>
 #include <utility>
 
 #include "../position.h"
@@ -35,11 +37,26 @@
 #include "nnue_common.h"
 
 namespace Stockfish::Eval::NNUE {
+inline namespace NNUE_ARCH {
 
 using BiasType       = std::int16_t;
-using WeightType     = std::int16_t;
 using PSQTWeightType = std::int32_t;
 
+// With NNUE_INT8_WEIGHTS the feature weights are quantised to int8 when the
+// net is loaded (see quantise_weights). Each block of WeightScaleBlock
+// weights of a feature has two int16 scales, one for its even and one for its
+// odd weights, so that a single 32-bit broadcast gives the scales of a whole
+// vector. That halves the memory streamed by accumulator updates and
+// refreshes, at the cost of a rounding error in the blocks with large weights.
+#if defined(NNUE_INT8_WEIGHTS)
+using WeightType = std::int8_t;
+#else
+using WeightType = std::int16_t;
+#endif
+using WeightScaleType = std::int16_t;
+
+constexpr IndexType WeightScaleBlock = 32;
+
 // If vector instructions are enabled, we update and refresh the
 // accumulator tile by tile such that each tile fits in the CPU's
 // vector registers.
@@ -48,6 +65,14 @@ using PSQTWeightType = std::int32_t;
 static_assert(PSQTBuckets % 8 == 0,
               "Per feature PSQT values cannot be processed at granularity lower than 8 at a time.");
 
+// The even and odd scales of a block of weights, as the 32-bit value whose
+// broadcast repeats them across the int16 lanes of a vector
+inline std::int32_t load_scale_pair(const std::int16_t* scales) {
+    std::int32_t pair;
+    std::memcpy(&pair, scales, sizeof(pair));
+    return pair;
+}
+
 #ifdef USE_AVX512
 using vec_t      = __m512i;
 using psqt_vec_t = __m256i;
@@ -60,6 +85,9 @@ using psqt_vec_t = __m256i;
     #define vec_set_16(a) _mm512_set1_epi16(a)
     #define vec_max_16(a, b) _mm512_max_epi16(a, b)
     #define vec_min_16(a, b) _mm512_min_epi16(a, b)
+    #define vec_load_8_to_16(a) \
+        _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(a)))
+    #define vec_load_scales_16(a) _mm512_set1_epi32(load_scale_pair(a))
 inline vec_t vec_msb_pack_16(vec_t a, vec_t b) {
     vec_t compacted = _mm512_packs_epi16(_mm512_srli_epi16(a, 7), _mm512_srli_epi16(b, 7));
     return _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), compacted);
@@ -84,6 +112,9 @@ using psqt_vec_t = __m256i;
     #define vec_set_16(a) _mm256_set1_epi16(a)
     #define vec_max_16(a, b) _mm256_max_epi16(a, b)
     #define vec_min_16(a, b) _mm256_min_epi16(a, b)
+    #define vec_load_8_to_16(a) \
+        _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(a)))
+    #define vec_load_scales_16(a) _mm256_set1_epi32(load_scale_pair(a))
 inline vec_t vec_msb_pack_16(vec_t a, vec_t b) {
     vec_t compacted = _mm256_packs_epi16(_mm256_srli_epi16(a, 7), _mm256_srli_epi16(b, 7));
     return _mm256_permute4x64_epi64(compacted, 0b11011000);
@@ -108,6 +139,16 @@ using psqt_vec_t = __m128i;
     #define vec_set_16(a) _mm_set1_epi16(a)
     #define vec_max_16(a, b) _mm_max_epi16(a, b)
     #define vec_min_16(a, b) _mm_min_epi16(a, b)
+    #define vec_load_scales_16(a) _mm_set1_epi32(load_scale_pair(a))
+    #ifdef USE_SSE41
+        #define vec_load_8_to_16(a) \
+            _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a)))
+    #else
+inline vec_t vec_load_8_to_16(const std::int8_t* a) {
+    const vec_t bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a));
+    return _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+}
+    #endif
     #define vec_msb_pack_16(a, b) _mm_packs_epi16(_mm_srli_epi16(a, 7), _mm_srli_epi16(b, 7))
     #define vec_load_psqt(a) (*(a))
     #define vec_store_psqt(a, b) *(a) = (b)
@@ -130,6 +171,8 @@ using psqt_vec_t = int32x4_t;
     #define vec_set_16(a) vdupq_n_s16(a)
     #define vec_max_16(a, b) vmaxq_s16(a, b)
     #define vec_min_16(a, b) vminq_s16(a, b)
+    #define vec_load_8_to_16(a) vmovl_s8(vld1_s8(a))
+    #define vec_load_scales_16(a) vreinterpretq_s16_s32(vdupq_n_s32(load_scale_pair(a)))
 inline vec_t vec_msb_pack_16(vec_t a, vec_t b) {
     const int8x8_t  shifta    = vshrn_n_s16(a, 7);
     const int8x8_t  shiftb    = vshrn_n_s16(b, 7);
@@ -193,20 +236,37 @@ static constexpr int BestRegisterCount() {
 
 
 // Input feature converter
-template<IndexType                                 TransformedFeatureDimensions,
-         Accumulator<TransformedFeatureDimensions> StateInfo::*accPtr>
+template<IndexType TransformedFeatureDimensions, NetSize Net_Size>
 class FeatureTransformer {
 
    private:
     // Number of output dimensions for one side
     static constexpr IndexType HalfDimensions = TransformedFeatureDimensions;
 
+    // The accumulators and refresh cache entries of the net size are as wide
+    // as its widest net, of which only the first HalfDimensions are used
+    static constexpr IndexType AccumulatorDimensions = MaxNetWidth<Net_Size>;
+    static_assert(HalfDimensions <= AccumulatorDimensions);
+
+    static constexpr auto accPtr = accumulator_of<Net_Size>();
+
 #ifdef VECTOR
+    #if defined(NNUE_INT8_WEIGHTS)
+    // Keep two registers for widening the weights and for their scale
+    static constexpr int MaxAccumulatorRegs = NumRegistersSIMD - 2;
+    #else
+    static constexpr int MaxAccumulatorRegs = NumRegistersSIMD;
+    #endif
+
     static constexpr int NumRegs =
-      BestRegisterCount<vec_t, WeightType, TransformedFeatureDimensions, NumRegistersSIMD>();
+      BestRegisterCount<vec_t, BiasType, TransformedFeatureDimensions, MaxAccumulatorRegs>();
     static constexpr int NumPsqtRegs =
       BestRegisterCount<psqt_vec_t, PSQTWeightType, PSQTBuckets, NumRegistersSIMD>();
 
+    // Number of accumulator (and weight) values in one vector
+    static constexpr IndexType VectorLanes = sizeof(vec_t) / sizeof(BiasType);
+    static_assert(WeightScaleBlock % VectorLanes == 0, "A vector must not span two blocks");
+
     static constexpr IndexType TileHeight     = NumRegs * sizeof(vec_t) / 2;
     static constexpr IndexType PsqtTileHeight = NumPsqtRegs * sizeof(psqt_vec_t) / 4;
     static_assert(HalfDimensions % TileHeight == 0, "TileHeight must divide HalfDimensions");
@@ -221,6 +281,12 @@ class FeatureTransformer {
     static constexpr IndexType InputDimensions  = FeatureSet::Dimensions;
     static constexpr IndexType OutputDimensions = HalfDimensions;
 
+    // Refresh cache of the net size
+    using CacheType = AccumulatorCaches::Cache<AccumulatorDimensions>;
+
+    // Nonzero 32-bit blocks of the output
+    using NonZeroOutputs = Layers::NonZeroChunks<OutputDimensions>;
+
     // Size of forward propagation buffer
     static constexpr std::size_t BufferSize = OutputDimensions * sizeof(OutputType);
 
@@ -233,7 +299,13 @@ class FeatureTransformer {
     bool read_parameters(std::istream& stream) {
 
         read_leb_128<BiasType>(stream, biases, HalfDimensions);
+#if defined(NNUE_INT8_WEIGHTS)
+        auto columns = std::make_unique<std::int16_t[]>(HalfDimensions * InputDimensions);
+        read_leb_128<std::int16_t>(stream, columns.get(), HalfDimensions * InputDimensions);
+        quantise_weights(columns.get());
+#else
         read_leb_128<WeightType>(stream, weights, HalfDimensions * InputDimensions);
+#endif
         read_leb_128<PSQTWeightType>(stream, psqtWeights, PSQTBuckets * InputDimensions);
 
         return !stream.fail();
@@ -243,25 +315,88 @@ class FeatureTransformer {
     bool write_parameters(std::ostream& stream) const {
 
         write_leb_128<BiasType>(stream, biases, HalfDimensions);
+#if defined(NNUE_INT8_WEIGHTS)
+        // The int16 weights the accumulators are updated with, so a net saved
+        // by this build evaluates the same in the int16 one
+        auto columns = std::make_unique<std::int16_t[]>(HalfDimensions * InputDimensions);
+        for (IndexType i = 0; i < HalfDimensions * InputDimensions; ++i)
+            columns[i] = weight(i);
+        write_leb_128<std::int16_t>(stream, columns.get(), HalfDimensions * InputDimensions);
+#else
         write_leb_128<WeightType>(stream, weights, HalfDimensions * InputDimensions);
+#endif
         write_leb_128<PSQTWeightType>(stream, psqtWeights, PSQTBuckets * InputDimensions);
 
         return !stream.fail();
     }
 
     // Convert input features
-    std::int32_t transform(const Position& pos, OutputType* output, int bucket) const {
-        update_accumulator<WHITE>(pos);
-        update_accumulator<BLACK>(pos);
+    std::int32_t transform(const Position&   pos,
+                           AccumulatorStack& stack,
+                           CacheType&        cache,
+                           OutputType*       output,
+                           int               bucket) const {
+        return transform<false>(pos, stack, cache, output, nullptr, bucket);
+    }
+
+    // Same, also collecting the nonzero 32-bit blocks of the output for fc_0
+    // while it is written (see Network::propagate)
+    std::int32_t transform(const Position&   pos,
+                           AccumulatorStack& stack,
+                           CacheType&        cache,
+                           OutputType*       output,
+                           NonZeroOutputs&   nnz,
+                           int               bucket) const {
+        return transform<true>(pos, stack, cache, output, &nnz, bucket);
+    }
+
+    void hint_common_access(const Position& pos, AccumulatorStack& stack, CacheType& cache) const {
+        hint_common_access_for_perspective<WHITE>(pos, stack, cache);
+        hint_common_access_for_perspective<BLACK>(pos, stack, cache);
+    }
+
+#if !defined(NNUE_INT8_WEIGHTS)
+    // Reorders the outputs without changing what they compute: output j of
+    // each perspective becomes what output order[j] was. Both accumulator
+    // values an output multiplies are moved with it, so the layer reading the
+    // outputs has to be reordered the same way (see Network::permute_inputs).
+    void permute_outputs(const IndexType* order) {
+        const auto permute = [order](BiasType* values) {
+            BiasType original[HalfDimensions];
+            std::memcpy(original, values, sizeof(original));
+            for (IndexType j = 0; j < HalfDimensions / 2; ++j)
+            {
+                values[j]                      = original[order[j]];
+                values[j + HalfDimensions / 2] = original[order[j] + HalfDimensions / 2];
+            }
+        };
+
+        permute(biases);
+        for (IndexType i = 0; i < InputDimensions; ++i)
+            permute(&weights[HalfDimensions * i]);
+    }
+#endif
+
+   private:
+    template<bool FindNonZero>
+    std::int32_t transform(const Position&   pos,
+                           AccumulatorStack& stack,
+                           CacheType&        cache,
+                           OutputType*       output,
+                           NonZeroOutputs*   nnz,
+                           int               bucket) const {
+        update_accumulator<WHITE>(pos, stack, cache);
+        update_accumulator<BLACK>(pos, stack, cache);
 
         const Color perspectives[2]  = {pos.side_to_move(), ~pos.side_to_move()};
-        const auto& accumulation     = (pos.state()->*accPtr).accumulation;
-        const auto& psqtAccumulation = (pos.state()->*accPtr).psqtAccumulation;
+        const auto& accumulation     = (stack.latest().*accPtr).accumulation;
+        const auto& psqtAccumulation = (stack.latest().*accPtr).psqtAccumulation;
 
         const auto psqt =
           (psqtAccumulation[perspectives[0]][bucket] - psqtAccumulation[perspectives[1]][bucket])
           / 2;
 
+        [[maybe_unused]] IndexType nnzCount = 0;
 
         for (IndexType p = 0; p < 2; ++p)
         {
@@ -291,7 +426,14 @@ class FeatureTransformer {
                 const vec_t pa = vec_mul_16(sum0a, sum1a);
                 const vec_t pb = vec_mul_16(sum0b, sum1b);
 
-                out[j] = vec_msb_pack_16(pa, pb);
+                const vec_t packed = vec_msb_pack_16(pa, pb);
+                out[j]             = packed;
+
+    #if (USE_SSSE3 | (USE_NEON >= 8))
+                if constexpr (FindNonZero)
+                    Layers::append_nnz(packed, (offset + j * sizeof(vec_t)) / 4, nnz->indices,
+                                       nnzCount);
+    #endif
             }
 
 #else
@@ -309,45 +451,93 @@ class FeatureTransformer {
 #endif
         }
 
+        if constexpr (FindNonZero)
+            nnz->count = nnzCount;
+
         return psqt;
     }  // end of function transform()
 
-    void hint_common_access(const Position& pos) const {
-        hint_common_access_for_perspective<WHITE>(pos);
-        hint_common_access_for_perspective<BLACK>(pos);
+#if defined(NNUE_INT8_WEIGHTS)
+    // Quantises the int16 weights read from the net. The even and the odd
+    // weights of each block get the smallest scale that brings them into the
+    // int8 range, so the ones that already fit are kept exactly.
+    void quantise_weights(const std::int16_t* columns) {
+        for (IndexType i = 0; i < HalfDimensions * InputDimensions; i += WeightScaleBlock)
+            for (IndexType parity = 0; parity < 2; ++parity)
+            {
+                int maxWeight = 0;
+                for (IndexType j = i + parity; j < i + WeightScaleBlock; j += 2)
+                    maxWeight = std::max(maxWeight, std::abs(int(columns[j])));
+
+                const int scale = std::max(1, (maxWeight + 126) / 127);
+                weightScales[scale_index(i + parity)] = WeightScaleType(scale);
+
+                // Round to nearest, staying within int16 once scaled back
+                for (IndexType j = i + parity; j < i + WeightScaleBlock; j += 2)
+                {
+                    int q = std::min({(std::abs(int(columns[j])) + scale / 2) / scale, 127,
+                                      32767 / scale});
+                    weights[j] = WeightType(columns[j] < 0 ? -q : q);
+                }
+            }
     }
 
-   private:
+    // Index of the scale of the weight at offset
+    static constexpr IndexType scale_index(IndexType offset) {
+        return offset / WeightScaleBlock * 2 + offset % 2;
+    }
+#endif
+
+    // The weight at offset, as it is added to the accumulator
+    BiasType weight(IndexType offset) const {
+#if defined(NNUE_INT8_WEIGHTS)
+        return BiasType(weights[offset] * weightScales[scale_index(offset)]);
+#else
+        return weights[offset];
+#endif
+    }
+
+#ifdef VECTOR
+    // The vector of weights starting at offset, as it is added to the
+    // accumulator
+    vec_t load_weights(IndexType offset) const {
+    #if defined(NNUE_INT8_WEIGHTS)
+        return vec_mul_16(vec_load_8_to_16(&weights[offset]),
+                          vec_load_scales_16(&weightScales[scale_index(offset)]));
+    #else
+        return vec_load(reinterpret_cast<const vec_t*>(&weights[offset]));
+    #endif
+    }
+#endif
+
     template<Color Perspective>
-    [[nodiscard]] std::pair<StateInfo*, StateInfo*>
-    try_find_computed_accumulator(const Position& pos) const {
+    [[nodiscard]] std::pair<AccumulatorState*, AccumulatorState*>
+    try_find_computed_accumulator(const Position& pos, AccumulatorStack& stack) const {
         // Look for a usable accumulator of an earlier position. We keep track
         // of the estimated gain in terms of features to be added/subtracted.
-        StateInfo *st = pos.state(), *next = nullptr;
-        int        gain = FeatureSet::refresh_cost(pos);
-        while (st->previous && !(st->*accPtr).computed[Perspective])
+        AccumulatorState *st = &stack.latest(), *next = nullptr;
+        int               gain = FeatureSet::refresh_cost(pos);
+        while (st != &stack.root() && !(st->*accPtr).computed[Perspective])
         {
             // This governs when a full feature refresh is needed and how many
             // updates are better than just one full refresh.
-            if (FeatureSet::requires_refresh(st, Perspective)
-                || (gain -= FeatureSet::update_cost(st) + 1) < 0)
+            if (FeatureSet::requires_refresh(st->dirtyPiece, Perspective)
+                || (gain -= FeatureSet::update_cost(st->dirtyPiece) + 1) < 0)
                 break;
             next = st;
-            st   = st->previous;
+            --st;
         }
         return {st, next};
     }
 
-    // NOTE: The parameter states_to_update is an array of position states, ending with nullptr.
-    //       All states must be sequential, that is states_to_update[i] must either be reachable
-    //       by repeatedly applying ->previous from states_to_update[i+1] or
-    //       states_to_update[i] == nullptr.
-    //       computed_st must be reachable by repeatedly applying ->previous on
-    //       states_to_update[0], if not nullptr.
+    // NOTE: The parameter states_to_update is an array of accumulator states, ending with nullptr.
+    //       All states must be sequential, that is states_to_update[i] must either be below
+    //       states_to_update[i+1] on the accumulator stack or states_to_update[i] == nullptr.
+    //       computed_st must be below states_to_update[0] on the stack, if not nullptr.
     template<Color Perspective, size_t N>
-    void update_accumulator_incremental(const Position& pos,
-                                        StateInfo*      computed_st,
-                                        StateInfo*      states_to_update[N]) const {
+    void update_accumulator_incremental(const Position&   pos,
+                                        AccumulatorState* computed_st,
+                                        AccumulatorState* states_to_update[N]) const {
         static_assert(N > 0);
         assert(states_to_update[N - 1] == nullptr);
 
@@ -379,21 +569,21 @@ class FeatureTransformer {
             while (states_to_update[i] == nullptr)
                 --i;
 
-            StateInfo* st2 = states_to_update[i];
+            AccumulatorState* st2 = states_to_update[i];
 
             for (; i >= 0; --i)
             {
                 (states_to_update[i]->*accPtr).computed[Perspective] = true;
 
-                const StateInfo* end_state = i == 0 ? computed_st : states_to_update[i - 1];
+                const AccumulatorState* end_state = i == 0 ? computed_st : states_to_update[i - 1];
 
-                for (; st2 != end_state; st2 = st2->previous)
+                for (; st2 != end_state; --st2)
                     FeatureSet::append_changed_indices<Perspective>(ksq, st2->dirtyPiece,
                                                                     removed[i], added[i]);
             }
         }
 
-        StateInfo* st = computed_st;
+        AccumulatorState* st = computed_st;
 
         // Now update the accumulators listed in states_to_update[], where the last element is a sentinel.
 #ifdef VECTOR
@@ -409,25 +599,24 @@ class FeatureTransformer {
               &(states_to_update[0]->*accPtr).accumulation[Perspective][0]);
 
             const IndexType offsetR0 = HalfDimensions * removed[0][0];
-            auto            columnR0 = reinterpret_cast<const vec_t*>(&weights[offsetR0]);
             const IndexType offsetA  = HalfDimensions * added[0][0];
-            auto            columnA  = reinterpret_cast<const vec_t*>(&weights[offsetA]);
 
             if (removed[0].size() == 1)
             {
-                for (IndexType k = 0; k < HalfDimensions * sizeof(std::int16_t) / sizeof(vec_t);
-                     ++k)
-                    accOut[k] = vec_add_16(vec_sub_16(accIn[k], columnR0[k]), columnA[k]);
+                for (IndexType k = 0; k < HalfDimensions / VectorLanes; ++k)
+                    accOut[k] = vec_add_16(
+                      vec_sub_16(accIn[k], load_weights(offsetR0 + k * VectorLanes)),
+                      load_weights(offsetA + k * VectorLanes));
             }
             else
             {
                 const IndexType offsetR1 = HalfDimensions * removed[0][1];
-                auto            columnR1 = reinterpret_cast<const vec_t*>(&weights[offsetR1]);
 
-                for (IndexType k = 0; k < HalfDimensions * sizeof(std::int16_t) / sizeof(vec_t);
-                     ++k)
-                    accOut[k] = vec_sub_16(vec_add_16(accIn[k], columnA[k]),
-                                           vec_add_16(columnR0[k], columnR1[k]));
+                for (IndexType k = 0; k < HalfDimensions / VectorLanes; ++k)
+                    accOut[k] = vec_sub_16(
+                      vec_add_16(accIn[k], load_weights(offsetA + k * VectorLanes)),
+                      vec_add_16(load_weights(offsetR0 + k * VectorLanes),
+                                 load_weights(offsetR1 + k * VectorLanes)));
             }
 
             auto accPsqtIn =
@@ -475,18 +664,16 @@ class FeatureTransformer {
                     for (const auto index : removed[i])
                     {
                         const IndexType offset = HalfDimensions * index + j * TileHeight;
-                        auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
                         for (IndexType k = 0; k < NumRegs; ++k)
-                            acc[k] = vec_sub_16(acc[k], column[k]);
+                            acc[k] = vec_sub_16(acc[k], load_weights(offset + k * VectorLanes));
                     }
 
                     // Difference calculation for the activated features
                     for (const auto index : added[i])
                     {
                         const IndexType offset = HalfDimensions * index + j * TileHeight;
-                        auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
                         for (IndexType k = 0; k < NumRegs; ++k)
-                            acc[k] = vec_add_16(acc[k], column[k]);
+                            acc[k] = vec_add_16(acc[k], load_weights(offset + k * VectorLanes));
                     }
 
                     // Store accumulator
@@ -549,10 +736,9 @@ class FeatureTransformer {
             // Difference calculation for the deactivated features
             for (const auto index : removed[i])
             {
-                const IndexType offset = HalfDimensions * index;
-
                 for (IndexType j = 0; j < HalfDimensions; ++j)
-                    (st->*accPtr).accumulation[Perspective][j] -= weights[offset + j];
+                    (st->*accPtr).accumulation[Perspective][j] -=
+                      weight(HalfDimensions * index + j);
 
                 for (std::size_t k = 0; k < PSQTBuckets; ++k)
                     (st->*accPtr).psqtAccumulation[Perspective][k] -=
@@ -562,10 +748,9 @@ class FeatureTransformer {
             // Difference calculation for the activated features
             for (const auto index : added[i])
             {
-                const IndexType offset = HalfDimensions * index;
-
                 for (IndexType j = 0; j < HalfDimensions; ++j)
-                    (st->*accPtr).accumulation[Perspective][j] += weights[offset + j];
+                    (st->*accPtr).accumulation[Perspective][j] +=
+                      weight(HalfDimensions * index + j);
 
                 for (std::size_t k = 0; k < PSQTBuckets; ++k)
                     (st->*accPtr).psqtAccumulation[Perspective][k] +=
@@ -576,7 +761,9 @@ class FeatureTransformer {
     }
 
     template<Color Perspective>
-    void update_accumulator_refresh(const Position& pos) const {
+    void update_accumulator_refresh_cache(const Position&   pos,
+                                          AccumulatorStack& stack,
+                                          CacheType&        cache) const {
 #ifdef VECTOR
         // Gcc-10.2 unnecessarily spills AVX2 registers if this array
         // is defined in the VECTOR code below, once in each branch
@@ -584,46 +771,101 @@ class FeatureTransformer {
         psqt_vec_t psqt[NumPsqtRegs];
 #endif
 
-        // Refresh the accumulator
-        // Could be extracted to a separate function because it's done in 2 places,
-        // but it's unclear if compilers would correctly handle register allocation.
-        auto& accumulator                 = pos.state()->*accPtr;
+        // Refresh the accumulator starting from the one cached for this king
+        // square, so only the pieces that differ from the cached board are
+        // removed or added, rather than every active feature.
+        const Square ksq   = pos.square<KING>(Perspective);
+        auto&        entry = cache.entry(ksq, Perspective);
+        if (!entry.initialized)
+            entry.clear(biases, HalfDimensions);
+        else
+        {
+            // The cached board may be further from this one than the empty
+            // board is, e.g. when evaluating unrelated positions
+            int changed = 0;
+            for (Color c : {WHITE, BLACK})
+                for (PieceType pt = PAWN; pt <= KING; ++pt)
+                    changed += popcount((entry.byColorBB[c] & entry.byTypeBB[pt]) ^ pos.pieces(c, pt));
+            if (changed > popcount(pos.pieces()))
+                entry.clear(biases, HalfDimensions);
+        }
+
+        FeatureSet::IndexList removed, added;
+        for (Color c : {WHITE, BLACK})
+        {
+            for (PieceType pt = PAWN; pt <= KING; ++pt)
+            {
+                const Piece    piece    = make_piece(c, pt);
+                const Bitboard oldBB    = entry.byColorBB[c] & entry.byTypeBB[pt];
+                const Bitboard newBB    = pos.pieces(c, pt);
+                Bitboard       toRemove = oldBB & ~newBB;
+                Bitboard       toAdd    = newBB & ~oldBB;
+
+                while (toRemove)
+                {
+                    Square sq = pop_lsb(toRemove);
+                    removed.push_back(FeatureSet::make_index<Perspective>(sq, piece, ksq));
+                }
+                while (toAdd)
+                {
+                    Square sq = pop_lsb(toAdd);
+                    added.push_back(FeatureSet::make_index<Perspective>(sq, piece, ksq));
+                }
+            }
+        }
+
+        auto& accumulator                 = stack.latest().*accPtr;
         accumulator.computed[Perspective] = true;
-        FeatureSet::IndexList active;
-        FeatureSet::append_active_indices<Perspective>(pos, active);
 
 #ifdef VECTOR
         for (IndexType j = 0; j < HalfDimensions / TileHeight; ++j)
         {
-            auto biasesTile = reinterpret_cast<const vec_t*>(&biases[j * TileHeight]);
+            auto entryTile = reinterpret_cast<vec_t*>(&entry.accumulation[j * TileHeight]);
             for (IndexType k = 0; k < NumRegs; ++k)
-                acc[k] = biasesTile[k];
+                acc[k] = vec_load(&entryTile[k]);
 
-            for (const auto index : active)
+            for (const auto index : removed)
             {
                 const IndexType offset = HalfDimensions * index + j * TileHeight;
-                auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
+                for (IndexType k = 0; k < NumRegs; ++k)
+                    acc[k] = vec_sub_16(acc[k], load_weights(offset + k * VectorLanes));
+            }
 
-                for (unsigned k = 0; k < NumRegs; ++k)
-                    acc[k] = vec_add_16(acc[k], column[k]);
+            for (const auto index : added)
+            {
+                const IndexType offset = HalfDimensions * index + j * TileHeight;
+                for (IndexType k = 0; k < NumRegs; ++k)
+                    acc[k] = vec_add_16(acc[k], load_weights(offset + k * VectorLanes));
             }
 
             auto accTile =
               reinterpret_cast<vec_t*>(&accumulator.accumulation[Perspective][j * TileHeight]);
-            for (unsigned k = 0; k < NumRegs; k++)
+            for (IndexType k = 0; k < NumRegs; ++k)
+            {
+                vec_store(&entryTile[k], acc[k]);
                 vec_store(&accTile[k], acc[k]);
+            }
         }
 
         for (IndexType j = 0; j < PSQTBuckets / PsqtTileHeight; ++j)
         {
+            auto entryTilePsqt =
+              reinterpret_cast<psqt_vec_t*>(&entry.psqtAccumulation[j * PsqtTileHeight]);
             for (std::size_t k = 0; k < NumPsqtRegs; ++k)
-                psqt[k] = vec_zero_psqt();
+                psqt[k] = vec_load_psqt(&entryTilePsqt[k]);
 
-            for (const auto index : active)
+            for (const auto index : removed)
             {
                 const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
                 auto columnPsqt        = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+                for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+                    psqt[k] = vec_sub_psqt_32(psqt[k], columnPsqt[k]);
+            }
 
+            for (const auto index : added)
+            {
+                const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+                auto columnPsqt        = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
                 for (std::size_t k = 0; k < NumPsqtRegs; ++k)
                     psqt[k] = vec_add_psqt_32(psqt[k], columnPsqt[k]);
             }
@@ -631,32 +873,49 @@ class FeatureTransformer {
             auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
               &accumulator.psqtAccumulation[Perspective][j * PsqtTileHeight]);
             for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+            {
+                vec_store_psqt(&entryTilePsqt[k], psqt[k]);
                 vec_store_psqt(&accTilePsqt[k], psqt[k]);
+            }
         }
 
 #else
-        std::memcpy(accumulator.accumulation[Perspective], biases,
-                    HalfDimensions * sizeof(BiasType));
+        for (const auto index : removed)
+        {
+            for (IndexType j = 0; j < HalfDimensions; ++j)
+                entry.accumulation[j] -= weight(HalfDimensions * index + j);
 
-        for (std::size_t k = 0; k < PSQTBuckets; ++k)
-            accumulator.psqtAccumulation[Perspective][k] = 0;
+            for (std::size_t k = 0; k < PSQTBuckets; ++k)
+                entry.psqtAccumulation[k] -= psqtWeights[index * PSQTBuckets + k];
+        }
 
-        for (const auto index : active)
+        for (const auto index : added)
         {
-            const IndexType offset = HalfDimensions * index;
-
             for (IndexType j = 0; j < HalfDimensions; ++j)
-                accumulator.accumulation[Perspective][j] += weights[offset + j];
+                entry.accumulation[j] += weight(HalfDimensions * index + j);
 
             for (std::size_t k = 0; k < PSQTBuckets; ++k)
-                accumulator.psqtAccumulation[Perspective][k] +=
-                  psqtWeights[index * PSQTBuckets + k];
+                entry.psqtAccumulation[k] += psqtWeights[index * PSQTBuckets + k];
         }
+
+        std::memcpy(accumulator.accumulation[Perspective], entry.accumulation,
+                    HalfDimensions * sizeof(BiasType));
+        std::memcpy(accumulator.psqtAccumulation[Perspective], entry.psqtAccumulation,
+                    PSQTBuckets * sizeof(PSQTWeightType));
 #endif
+
+        // The cached board is now the current one
+        for (Color c : {WHITE, BLACK})
+            entry.byColorBB[c] = pos.pieces(c);
+
+        for (PieceType pt = PAWN; pt <= KING; ++pt)
+            entry.byTypeBB[pt] = pos.pieces(pt);
     }
 
     template<Color Perspective>
-    void hint_common_access_for_perspective(const Position& pos) const {
+    void hint_common_access_for_perspective(const Position&   pos,
+                                            AccumulatorStack& stack,
+                                            CacheType&        cache) const {
 
         // Works like update_accumulator, but performs less work.
         // Updates ONLY the accumulator for pos.
@@ -664,25 +923,25 @@ class FeatureTransformer {
         // Look for a usable accumulator of an earlier position. We keep track
         // of the estimated gain in terms of features to be added/subtracted.
         // Fast early exit.
-        if ((pos.state()->*accPtr).computed[Perspective])
+        if ((stack.latest().*accPtr).computed[Perspective])
             return;
 
-        auto [oldest_st, _] = try_find_computed_accumulator<Perspective>(pos);
+        auto [oldest_st, _] = try_find_computed_accumulator<Perspective>(pos, stack);
 
         if ((oldest_st->*accPtr).computed[Perspective])
         {
             // Only update current position accumulator to minimize work.
-            StateInfo* states_to_update[2] = {pos.state(), nullptr};
+            AccumulatorState* states_to_update[2] = {&stack.latest(), nullptr};
             update_accumulator_incremental<Perspective, 2>(pos, oldest_st, states_to_update);
         }
         else
-            update_accumulator_refresh<Perspective>(pos);
+            update_accumulator_refresh_cache<Perspective>(pos, stack, cache);
     }
 
     template<Color Perspective>
-    void update_accumulator(const Position& pos) const {
+    void update_accumulator(const Position& pos, AccumulatorStack& stack, CacheType& cache) const {
 
-        auto [oldest_st, next] = try_find_computed_accumulator<Perspective>(pos);
+        auto [oldest_st, next] = try_find_computed_accumulator<Perspective>(pos, stack);
 
         if ((oldest_st->*accPtr).computed[Perspective])
         {
@@ -694,22 +953,27 @@ class FeatureTransformer {
             //     1. for the current position
             //     2. the next accumulator after the computed one
             // The heuristic may change in the future.
-            StateInfo* states_to_update[3] = {next, next == pos.state() ? nullptr : pos.state(),
-                                              nullptr};
+            AccumulatorState* states_to_update[3] = {
+              next, next == &stack.latest() ? nullptr : &stack.latest(), nullptr};
 
             update_accumulator_incremental<Perspective, 3>(pos, oldest_st, states_to_update);
         }
         else
         {
-            update_accumulator_refresh<Perspective>(pos);
+            update_accumulator_refresh_cache<Perspective>(pos, stack, cache);
         }
     }
 
     alignas(CacheLineSize) BiasType biases[HalfDimensions];
     alignas(CacheLineSize) WeightType weights[HalfDimensions * InputDimensions];
+#if defined(NNUE_INT8_WEIGHTS)
+    alignas(CacheLineSize)
+      WeightScaleType weightScales[HalfDimensions * InputDimensions / WeightScaleBlock * 2];
+#endif
     alignas(CacheLineSize) PSQTWeightType psqtWeights[InputDimensions * PSQTBuckets];
 };
 
+}  // inline namespace NNUE_ARCH
 }  // namespace Stockfish::Eval::NNUE
 
 #endif  // #ifndef NNUE_FEATURE_TRANSFORMER_H_INCLUDED
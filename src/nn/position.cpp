@@ -20,6 +20,7 @@
 
 #include <array>
 #include <cctype>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
 #include <sstream>
@@ -194,4 +195,133 @@ Position& Position::set(const string& fenStr, StateInfo* si) {
     gamePly = std::max(2 * (gamePly - 1), 0) + (sideToMove == BLACK);
     return *this;
 }
+
+// Makes a move given by its from and to squares, and the piece type promoted
+// to (NO_PIECE_TYPE otherwise). Captures, en passant and castling (the king
+// moving two squares) are read off the board. Only the board and the fields
+// needed by the evaluation are updated. Returns the pieces changed, to be
+// pushed on the accumulator stack so that the NNUE accumulators can be
+// updated incrementally from the previous position's.
+//
+// A move from an empty square, e.g. a castling move that surge generates
+// from a FEN whose castling rights don't match the board, only changes the
+// side to move, so that undo_move still takes it back.
+DirtyPiece Position::do_move(Square from, Square to, PieceType promotion, StateInfo& newSt) {
+
+    // Copy the fields that are not recomputed
+    std::memcpy(&newSt, st, offsetof(StateInfo, key));
+    newSt.previous = st;
+    st             = &newSt;
+
+    ++gamePly;
+    ++st->rule50;
+
+    Color       us       = sideToMove;
+    Piece       pc       = piece_on(from);
+    Square      capsq    = to;
+    Piece       captured = piece_on(to);
+    DirtyPiece  dp;
+
+    if (pc == NO_PIECE)
+    {
+        st->capturedPiece = NO_PIECE;
+        dp.dirty_num      = 0;
+        dp.piece[0]       = NO_PIECE;
+        sideToMove        = ~sideToMove;
+        return dp;
+    }
+
+    // En passant: a pawn moving diagonally to an empty square
+    if (type_of(pc) == PAWN && file_of(from) != file_of(to) && captured == NO_PIECE)
+    {
+        capsq    = make_square(file_of(to), rank_of(from));
+        captured = piece_on(capsq);
+    }
+
+    dp.dirty_num = 1;
+    dp.piece[0]  = pc;
+    dp.from[0]   = from;
+    dp.to[0]     = to;
+
+    if (captured != NO_PIECE)
+    {
+        if (type_of(captured) != PAWN)
+            st->nonPawnMaterial[~us] -= PieceValue[captured];
+
+        dp.dirty_num = 2;
+        dp.piece[1]  = captured;
+        dp.from[1]   = capsq;
+        dp.to[1]     = SQ_NONE;
+
+        remove_piece(capsq);
+        st->rule50 = 0;
+    }
+
+    st->capturedPiece = captured;
+
+    remove_piece(from);
+
+    if (promotion != NO_PIECE_TYPE)
+    {
+        Piece promoted = make_piece(us, promotion);
+        st->nonPawnMaterial[us] += PieceValue[promoted];
+
+        dp.to[0]               = SQ_NONE;
+        dp.piece[dp.dirty_num] = promoted;
+        dp.from[dp.dirty_num]  = SQ_NONE;
+        dp.to[dp.dirty_num]    = to;
+        dp.dirty_num++;
+
+        put_piece(promoted, to);
+    }
+    else
+        put_piece(pc, to);
+
+    // Castling: the king goes first in the DirtyPiece, so that
+    // requires_refresh sees a king move. The rook only moves if the king
+    // and the rook really were on their start squares.
+    if (type_of(pc) == KING && (from - to == 2 || to - from == 2)
+        && from == relative_square(us, SQ_E1)
+        && piece_on(relative_square(us, to > from ? SQ_H1 : SQ_A1)) == make_piece(us, ROOK))
+    {
+        bool   kingSide = to > from;
+        Square rfrom    = relative_square(us, kingSide ? SQ_H1 : SQ_A1);
+        Square rto      = relative_square(us, kingSide ? SQ_F1 : SQ_D1);
+        Piece  rook     = piece_on(rfrom);
+
+        dp.dirty_num = 2;
+        dp.piece[1]  = rook;
+        dp.from[1]   = rfrom;
+        dp.to[1]     = rto;
+
+        remove_piece(rfrom);
+        put_piece(rook, rto);
+    }
+
+    if (type_of(pc) == PAWN)
+        st->rule50 = 0;
+
+    sideToMove = ~sideToMove;
+
+    return dp;
+}
+
+// Unmakes the last move made with do_move, by replaying the DirtyPiece it
+// returned backwards, and goes back to the previous state.
+void Position::undo_move(const DirtyPiece& dp) {
+
+    assert(st->previous);
+
+    for (int i = 0; i < dp.dirty_num; ++i)
+        if (dp.to[i] != SQ_NONE)
+            remove_piece(dp.to[i]);
+
+    for (int i = 0; i < dp.dirty_num; ++i)
+        if (dp.from[i] != SQ_NONE)
+            put_piece(dp.piece[i], dp.from[i]);
+
+    st = st->previous;
+    --gamePly;
+    sideToMove = ~sideToMove;
+}
 }  // namespace Stockfish
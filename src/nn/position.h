@@ -26,8 +26,6 @@
 #include <string>
 
 #include "bitboard.h"
-#include "nnue/nnue_accumulator.h"
-#include "nnue/nnue_architecture.h"
 #include "types.h"
 
 namespace Stockfish {
@@ -56,11 +54,6 @@ struct StateInfo {
     Bitboard   checkSquares[PIECE_TYPE_NB];
     Piece      capturedPiece;
     int        repetition;
-
-    // Used by NNUE
-    Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsBig>   accumulatorBig;
-    Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsSmall> accumulatorSmall;
-    DirtyPiece                                                             dirtyPiece;
 };
 
 
@@ -88,6 +81,10 @@ class Position {
     Position&   set(const int pieceBoard[], bool side, int rule50, StateInfo* si);
     Position&   set(const std::string& fenStr, StateInfo* si);
 
+    // Doing and undoing moves
+    DirtyPiece do_move(Square from, Square to, PieceType promotion, StateInfo& newSt);
+    void       undo_move(const DirtyPiece& dp);
+
     // Position representation
     Bitboard pieces(PieceType pt = ALL_PIECES) const;
     template<typename... PieceTypes>
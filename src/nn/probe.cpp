@@ -2,7 +2,12 @@
 #include "bitboard.h"
 #include "position.h"
 #include "evaluate.h"
+#include "nnue/nnue_accumulator.h"
 #include "nnue/nnue_architecture.h"
+#include "nnue/nnue_dispatch.h"
+
+#include <cassert>
+#include <vector>
 
 namespace Stockfish {
 
@@ -25,34 +30,107 @@ namespace Stockfish {
             }
         }
 
+        const char* kernels() {
+            return Eval::NNUE::kernels().name;
+        }
+
+        // Accumulator stack and refresh caches for the one-off evaluations
+        // below, allocated once per thread rather than on every call
+        static Eval::NNUE::AccumulatorStack& scratch_stack() {
+            thread_local std::unique_ptr<Eval::NNUE::AccumulatorStack> stack(new Eval::NNUE::AccumulatorStack());
+            return *stack;
+        }
+
+        static Eval::NNUE::AccumulatorCaches& scratch_caches() {
+            thread_local std::unique_ptr<Eval::NNUE::AccumulatorCaches> caches(new Eval::NNUE::AccumulatorCaches());
+            return *caches;
+        }
+
         int eval(const char *fen) {
             Position pos;
-            StateListPtr states(new std::deque<StateInfo>(1));
+            StateInfo st;
+            Eval::NNUE::AccumulatorStack& stack = scratch_stack();
 
-            pos.set(fen, &states->back());
-            int eval = Eval::evaluate(pos);
+            pos.set(fen, &st);
+            stack.reset();
+            int eval = Eval::evaluate(pos, stack, scratch_caches());
 
             return eval;
         }
 
         int eval(const int pieceBoard[], bool side, int rule50) {
             Position pos;
-            StateListPtr states(new std::deque<StateInfo>(1));
+            StateInfo st;
+            Eval::NNUE::AccumulatorStack& stack = scratch_stack();
 
-            pos.set(pieceBoard, side, rule50, &states->back());
-            int eval = Eval::evaluate(pos);
+            pos.set(pieceBoard, side, rule50, &st);
+            stack.reset();
+            int eval = Eval::evaluate(pos, stack, scratch_caches());
 
             return eval;
         }
 
         int eval(const int pieces[], const int squares[], int pieceAmount, bool side, int rule50) {
             Position pos;
-            StateListPtr states(new std::deque<StateInfo>(1));
+            StateInfo st;
+            Eval::NNUE::AccumulatorStack& stack = scratch_stack();
 
-            pos.set(pieces, squares, pieceAmount, side, rule50, &states->back());
-            int eval = Eval::evaluate(pos);
+            pos.set(pieces, squares, pieceAmount, side, rule50, &st);
+            stack.reset();
+            int eval = Eval::evaluate(pos, stack, scratch_caches());
 
             return eval;
         }
+
+        void eval_batch(const char* const fens[], int count, int evals[]) {
+            std::vector<Position> positions(count);
+            std::vector<StateInfo> states(count);
+            std::vector<const Position*> pointers(count);
+            std::vector<Value> values(count);
+
+            for (int i = 0; i < count; ++i) {
+                positions[i].set(fens[i], &states[i]);
+                pointers[i] = &positions[i];
+            }
+            Eval::evaluate_batch(pointers.data(), count, values.data(), scratch_stack(), scratch_caches());
+
+            for (int i = 0; i < count; ++i)
+                evals[i] = values[i];
+        }
+
+        Evaluator::Evaluator() :
+            pos(new Position()),
+            states(new StateInfo[MAX_PLY + 1]),
+            accumulators(new Eval::NNUE::AccumulatorStack()),
+            caches(new Eval::NNUE::AccumulatorCaches()) {}
+
+        Evaluator::~Evaluator() = default;
+
+        void Evaluator::set(const int pieces[], const int squares[], int pieceAmount, bool side, int rule50) {
+            ply = 0;
+            pos->set(pieces, squares, pieceAmount, side, rule50, &states[0]);
+            accumulators->reset();
+        }
+
+        void Evaluator::do_move(int from, int to, int promotion) {
+            assert(ply < MAX_PLY);
+            ++ply;
+            accumulators->push(pos->do_move(Square(from), Square(to), PieceType(promotion), states[ply]));
+        }
+
+        void Evaluator::undo_move() {
+            assert(ply > 0);
+            pos->undo_move(accumulators->latest().dirtyPiece);
+            accumulators->pop();
+            --ply;
+        }
+
+        int Evaluator::eval() const {
+            return Eval::evaluate(*pos, *accumulators, *caches);
+        }
+
+        int Evaluator::rule50_count() const {
+            return pos->rule50_count();
+        }
     }
 }
\ No newline at end of file
@@ -1,13 +1,60 @@
 #ifndef STOCKFISH_PROBE_H
 #define STOCKFISH_PROBE_H
 
+#include <memory>
+
 namespace Stockfish {
+    class Position;
+    struct StateInfo;
+
+    namespace Eval::NNUE {
+        class AccumulatorStack;
+        struct AccumulatorCaches;
+    }
+
     namespace Probe {
         void init(const char*, const char*);
 
+        // Instruction set of the NNUE kernels picked for this CPU, e.g. "AVX2"
+        const char* kernels();
+
         int eval(const char *fen);
         int eval(const int pieceBoard[], bool side, int rule50);
         int eval(const int pieces[], const int squares[], int pieceAmount, bool side, int rule50);
+
+        // Evaluates count FENs into evals, for rescoring many positions at
+        // once. Much faster than calling eval for each of them.
+        void eval_batch(const char* const fens[], int count, int evals[]);
+
+        // Keeps a position, a state per ply, an accumulator stack and the
+        // refresh caches between evaluations. The search makes and unmakes
+        // its moves on it, so the accumulators are updated from the parent
+        // position's instead of being refreshed on every call; only king
+        // moves need a refresh, and that starts from the cached accumulator
+        // for the king's square. Use one per thread.
+        class Evaluator {
+            public:
+                Evaluator();
+                ~Evaluator();
+
+                // Sets up the root position, same arguments as eval
+                void set(const int pieces[], const int squares[], int pieceAmount, bool side, int rule50);
+
+                // Squares are 0 (a1) to 63 (h8), promotion is the piece
+                // type promoted to (2 = knight ... 5 = queen) or 0
+                void do_move(int from, int to, int promotion = 0);
+                void undo_move();
+
+                int eval() const;
+                int rule50_count() const;
+
+            private:
+                std::unique_ptr<Position> pos;
+                std::unique_ptr<StateInfo[]> states;
+                std::unique_ptr<Eval::NNUE::AccumulatorStack> accumulators;
+                std::unique_ptr<Eval::NNUE::AccumulatorCaches> caches;
+                int ply = 0;
+        };
     }
 }
 
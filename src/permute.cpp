@@ -0,0 +1,334 @@
+#include "nn/bitboard.h"
+#include "nn/position.h"
+#include "nn/nnue/nnue_accumulator.h"
+#include "nn/nnue/nnue_architecture.h"
+#include "nn/nnue/nnue_feature_transformer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+// Reorders the L1 neurons of a net, the feature transformer outputs that fc_0
+// reads, so that neurons which are zero in the same positions share the
+// 4-byte blocks fc_0 skips when they are all zero (see find_nnz in
+// nn/nnue/layers/affine_transform_sparse_input.h). The reordered net
+// computes exactly the same evaluations.
+//
+// Usage: permute <net.nnue> <fens> <output.nnue>
+//
+// Every position of the FEN file, one per line, is evaluated and the
+// neurons that are nonzero are recorded. The neurons are sorted by how often
+// they are nonzero, and neurons of different blocks are then swapped as long
+// as that lowers the number of nonzero blocks over the recorded positions.
+// The reordered net is written, read back and evaluated again, and it is
+// deleted unless every evaluation is the same as with the original net.
+
+using namespace Stockfish;
+using namespace Stockfish::Eval::NNUE;
+
+// Number of positions whose activations are kept for the swaps
+constexpr std::size_t MaxSamplePositions = 32768;
+constexpr int         MaxSwapPasses      = 8;
+
+// Which neurons are nonzero, one bit per sample (a position seen from one
+// perspective) for each neuron
+struct Activations {
+    std::size_t                words;
+    std::vector<std::uint64_t> bits;
+
+    Activations(IndexType neurons, std::size_t samples) :
+        words((samples + 63) / 64),
+        bits(neurons * words) {}
+
+    std::uint64_t* neuron(IndexType n) { return &bits[n * words]; }
+};
+
+// Number of samples in which a block of neurons isn't all zero
+static std::size_t block_count(Activations& activations, const IndexType* neurons, IndexType size) {
+    std::size_t count = 0;
+    for (std::size_t w = 0; w < activations.words; ++w) {
+        std::uint64_t any = 0;
+        for (IndexType k = 0; k < size; ++k)
+            any |= activations.neuron(neurons[k])[w];
+        count += popcount(any);
+    }
+    return count;
+}
+
+// Swaps neurons between blocks of BlockSize while that lowers the total
+// number of nonzero blocks
+template<IndexType BlockSize>
+static void improve_order(Activations& activations, std::vector<IndexType>& order) {
+    const IndexType blocks = IndexType(order.size()) / BlockSize;
+    const auto      words  = activations.words;
+
+    // For each neuron of a block, the samples in which one of the other
+    // neurons of the block is nonzero
+    std::vector<std::uint64_t> others(order.size() * words);
+    std::vector<std::size_t>   counts(blocks);
+    const auto                 update = [&](IndexType b) {
+        const IndexType* block = &order[b * BlockSize];
+        for (IndexType k = 0; k < BlockSize; ++k)
+            for (std::size_t w = 0; w < words; ++w) {
+                std::uint64_t any = 0;
+                for (IndexType l = 0; l < BlockSize; ++l)
+                    if (l != k)
+                        any |= activations.neuron(block[l])[w];
+                others[(b * BlockSize + k) * words + w] = any;
+            }
+        counts[b] = block_count(activations, block, BlockSize);
+    };
+    for (IndexType b = 0; b < blocks; ++b)
+        update(b);
+
+    for (int pass = 0; pass < MaxSwapPasses; ++pass) {
+        std::size_t swaps = 0;
+        for (IndexType a = 0; a < blocks; ++a)
+            for (IndexType b = a + 1; b < blocks; ++b)
+                for (IndexType i = 0; i < BlockSize; ++i)
+                    for (IndexType j = 0; j < BlockSize; ++j) {
+                        const std::uint64_t* bitsI = activations.neuron(order[a * BlockSize + i]);
+                        const std::uint64_t* bitsJ = activations.neuron(order[b * BlockSize + j]);
+                        const std::uint64_t* restA = &others[(a * BlockSize + i) * words];
+                        const std::uint64_t* restB = &others[(b * BlockSize + j) * words];
+
+                        std::size_t swapped = 0;
+                        for (std::size_t w = 0; w < words; ++w)
+                            swapped += popcount(restA[w] | bitsJ[w]) + popcount(restB[w] | bitsI[w]);
+
+                        if (swapped < counts[a] + counts[b]) {
+                            std::swap(order[a * BlockSize + i], order[b * BlockSize + j]);
+                            update(a);
+                            update(b);
+                            ++swaps;
+                        }
+                    }
+        std::printf("Swap pass %d: %zu swaps\n", pass + 1, swaps);
+        if (!swaps)
+            break;
+    }
+}
+
+// A whole net of width L1: the feature transformer and the layer stacks. The
+// big net size takes every width, and the layers of a small net are the same
+// as those of a big net of its width.
+template<IndexType L1>
+struct Net {
+    using Transformer = FeatureTransformer<L1, Big>;
+    using Stack       = NetworkOf<Big, L1>;
+
+    static constexpr std::uint32_t HashValue =
+      Transformer::get_hash_value() ^ Stack::get_hash_value();
+
+    std::unique_ptr<Transformer>                     transformer = std::make_unique<Transformer>();
+    std::unique_ptr<Stack>                           stacks[LayerStacks];
+    std::unique_ptr<typename Transformer::CacheType> cache =
+      std::make_unique<typename Transformer::CacheType>();
+
+    Net() {
+        for (auto& stack : stacks)
+            stack = std::make_unique<Stack>();
+    }
+
+    // Reads the parameters that follow the header
+    bool read_parameters(std::istream& stream) {
+        if (read_little_endian<std::uint32_t>(stream) != Transformer::get_hash_value()
+            || !transformer->read_parameters(stream))
+            return false;
+        for (auto& stack : stacks)
+            if (read_little_endian<std::uint32_t>(stream) != Stack::get_hash_value()
+                || !stack->read_parameters(stream))
+                return false;
+        cache->clear();
+        return stream && stream.peek() == std::ios::traits_type::eof();
+    }
+
+    bool write(std::ostream& stream, const std::string& description) const {
+        write_little_endian<std::uint32_t>(stream, Version);
+        write_little_endian<std::uint32_t>(stream, HashValue);
+        write_little_endian<std::uint32_t>(stream, std::uint32_t(description.size()));
+        stream.write(description.data(), description.size());
+        write_little_endian<std::uint32_t>(stream, Transformer::get_hash_value());
+        if (!transformer->write_parameters(stream))
+            return false;
+        for (auto& stack : stacks) {
+            write_little_endian<std::uint32_t>(stream, Stack::get_hash_value());
+            if (!stack->write_parameters(stream))
+                return false;
+        }
+        return bool(stream);
+    }
+
+    // Evaluates the positions, returning the raw output of the net. The
+    // activations of the first ones are recorded if asked for.
+    std::vector<std::int32_t> evaluate(const std::vector<Position>& positions,
+                                       Activations*                 activations,
+                                       std::size_t&                 nonZeroBlocks) {
+        auto stack = std::make_unique<AccumulatorStack>();
+        alignas(CacheLineSize) TransformedFeatureType transformed[Transformer::BufferSize];
+        std::vector<std::int32_t>                     values(positions.size());
+
+        nonZeroBlocks = 0;
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            const Position& pos    = positions[i];
+            const int       bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+
+            stack->reset();
+            const std::int32_t psqt = transformer->transform(pos, *stack, *cache, transformed, bucket);
+            values[i]               = psqt + stacks[bucket]->propagate(transformed);
+
+            for (IndexType b = 0; b < L1; b += 4)
+                nonZeroBlocks += transformed[b] || transformed[b + 1] || transformed[b + 2]
+                              || transformed[b + 3];
+
+            if (activations && i < MaxSamplePositions)
+                for (IndexType p = 0; p < 2; ++p)
+                    for (IndexType n = 0; n < L1 / 2; ++n)
+                        if (transformed[p * L1 / 2 + n])
+                            activations->neuron(n)[(2 * i + p) / 64] |=
+                              std::uint64_t(1) << ((2 * i + p) % 64);
+        }
+        return values;
+    }
+
+    // Reorders the neurons: neuron n becomes what neuron order[n] was
+    void permute(const std::vector<IndexType>& order) {
+        std::vector<IndexType> inputs(L1);
+        for (IndexType p = 0; p < 2; ++p)
+            for (IndexType n = 0; n < L1 / 2; ++n)
+                inputs[p * L1 / 2 + n] = p * L1 / 2 + order[n];
+
+        transformer->permute_outputs(order.data());
+        for (auto& stack : stacks)
+            stack->permute_inputs(inputs.data());
+    }
+};
+
+template<typename NetType>
+static int run(std::istream&                stream,
+               const std::string&           description,
+               const std::vector<Position>& positions,
+               const std::string&           outputPath) {
+    constexpr IndexType Neurons = NetType::Transformer::OutputDimensions / 2;
+
+    auto net = std::make_unique<NetType>();
+    if (!net->read_parameters(stream)) {
+        std::fprintf(stderr, "Failed to read the net\n");
+        return 1;
+    }
+
+    Activations activations(Neurons, 2 * std::min(positions.size(), MaxSamplePositions));
+    std::size_t blocksBefore, blocksAfter;
+    const std::vector<std::int32_t> before = net->evaluate(positions, &activations, blocksBefore);
+
+    std::vector<std::size_t> active(Neurons);
+    for (IndexType n = 0; n < Neurons; ++n)
+        for (std::size_t w = 0; w < activations.words; ++w)
+            active[n] += popcount(activations.neuron(n)[w]);
+
+    std::vector<IndexType> order(Neurons);
+    std::iota(order.begin(), order.end(), IndexType(0));
+    std::stable_sort(order.begin(), order.end(),
+                     [&](IndexType a, IndexType b) { return active[a] > active[b]; });
+    improve_order<4>(activations, order);
+
+    net->permute(order);
+    {
+        std::ofstream output(outputPath, std::ios::binary);
+        if (!net->write(output, description)) {
+            std::fprintf(stderr, "Failed to write %s\n", outputPath.c_str());
+            return 1;
+        }
+    }
+
+    // Check the file that was written, not the net in memory
+    std::ifstream written(outputPath, std::ios::binary);
+    std::uint32_t header[3];
+    for (auto& value : header)
+        value = read_little_endian<std::uint32_t>(written);
+    written.ignore(header[2]);
+    if (header[0] != Version || header[1] != NetType::HashValue || !net->read_parameters(written)) {
+        std::fprintf(stderr, "Failed to read back %s\n", outputPath.c_str());
+        return 1;
+    }
+    const std::vector<std::int32_t> after = net->evaluate(positions, nullptr, blocksAfter);
+
+    std::size_t different = 0;
+    for (std::size_t i = 0; i < positions.size(); ++i)
+        different += before[i] != after[i];
+
+    const double n = std::max<std::size_t>(positions.size(), 1);
+    std::printf("Positions: %zu\n", positions.size());
+    std::printf("Nonzero fc_0 input blocks per evaluation: %.1f before, %.1f after (of %u)\n",
+                blocksBefore / n, blocksAfter / n, unsigned(NetType::Transformer::OutputDimensions / 4));
+
+    if (different) {
+        std::fprintf(stderr, "%zu evaluations differ, %s removed\n", different, outputPath.c_str());
+        written.close();
+        std::filesystem::remove(outputPath);
+        return 1;
+    }
+    std::printf("All evaluations identical, written: %s\n", outputPath.c_str());
+    return 0;
+}
+
+// Runs on the net with the width of NetWidths[I] or a later one that has the
+// hash value
+template<std::size_t I = 0>
+static int run_width(std::uint32_t                hashValue,
+                     std::istream&                stream,
+                     const std::string&           description,
+                     const std::vector<Position>& positions,
+                     const std::string&           outputPath) {
+    if constexpr (I < std::size(NetWidths)) {
+        using NetType = Net<NetWidths[I]>;
+        if (hashValue == NetType::HashValue)
+            return run<NetType>(stream, description, positions, outputPath);
+        return run_width<I + 1>(hashValue, stream, description, positions, outputPath);
+    } else
+        return -1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::fprintf(stderr, "Usage: %s <net.nnue> <fens> <output.nnue>\n", argv[0]);
+        return 1;
+    }
+
+    Bitboards::init();
+
+    std::ifstream            fenFile(argv[2]);
+    std::vector<std::string> fens;
+    for (std::string line; std::getline(fenFile, line);)
+        if (!line.empty())
+            fens.push_back(line);
+
+    std::vector<Position>  positions(fens.size());
+    std::vector<StateInfo> states(fens.size());
+    for (std::size_t i = 0; i < fens.size(); ++i)
+        positions[i].set(fens[i], &states[i]);
+
+    std::ifstream stream(argv[1], std::ios::binary);
+    std::uint32_t version     = read_little_endian<std::uint32_t>(stream);
+    std::uint32_t hashValue   = read_little_endian<std::uint32_t>(stream);
+    std::string   description(read_little_endian<std::uint32_t>(stream), '\0');
+    stream.read(&description[0], description.size());
+    if (!stream || version != Version) {
+        std::fprintf(stderr, "Failed to read %s\n", argv[1]);
+        return 1;
+    }
+
+    const int result = run_width(hashValue, stream, description, positions, argv[3]);
+    if (result < 0) {
+        std::fprintf(stderr, "%s isn't a net of any width this build knows\n", argv[1]);
+        return 1;
+    }
+    return result;
+}
@@ -1,7 +1,131 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+
+// Material + PST evaluation shared by the engine and the benchmark search.
+// It works on surge's Position, so include it after surge's position.h.
+
+// Packed middlegame/endgame score: the endgame value is kept in the upper 16
+// bits and the middlegame value in the lower 16 bits, so that both are
+// updated with a single addition
+typedef int32_t Score;
+
+constexpr Score makeScore(int midgame, int endgame) {
+    return (Score) ((uint32_t) endgame << 16) + midgame;
+}
+
+inline int midgameValue(Score score) {
+    return int16_t(uint16_t(uint32_t(score)));
+}
+
+inline int endgameValue(Score score) {
+    return int16_t(uint16_t((uint32_t(score) + 0x8000) >> 16));
+}
+
+// Material + PST score from white's point of view and game phase of a
+// position, kept up to date move by move
+struct PsqtState {
+    Score score = 0;
+    int gamePhase = 0;
+};
+
+const int MAX_GAME_PHASE = 24;
+
 class PST {
 public:
+    int midgamePieceValues[14] = {82, 337, 365, 477, 1025, 0, 0, 0, -82, -337, -365, -477, -1025, 0};
+    int endgamePieceValues[14] = {94, 281, 297, 512, 936, 0, 0, 0, -94, -281, -297, -512, -936, 0};
+    int gamePhaseIncrement[14] = {0, 1, 1, 2, 4, 0, 0, 0, 0, 1, 1, 2, 4, 0};
+
+    // Piece values and both PSTs merged into one packed table
+    Score psq[14][64];
+
+    PST() {
+        for (int piece = 0; piece < 14; ++piece) {
+            for (int square = 0; square < 64; ++square) {
+                psq[piece][square] = makeScore(midgamePieceValues[piece] + midgamePst[piece][square],
+                                               endgamePieceValues[piece] + endgamePst[piece][square]);
+            }
+        }
+    }
+
+    // Full recompute of the incremental material + PST state
+    PsqtState computeState(const Position& position) const {
+        PsqtState state;
+        for (int i = WHITE_PAWN; i < NO_PIECE; ++i) {
+            Bitboard bitboard = position.bitboard_of(static_cast<Piece>(i));
+            while (bitboard) {
+                int square = __builtin_ctzll(bitboard);
+                bitboard &= bitboard - 1;
+                state.score += psq[i][square];
+                state.gamePhase += gamePhaseIncrement[i];
+            }
+        }
+        return state;
+    }
+
+    // Updates the state for a move about to be played by Us. Call it before
+    // position.play, and restore the previous state after position.undo.
+    template<Color Us>
+    void update(PsqtState& state, const Position& position, Move move) const {
+        Square from = move.from();
+        Square to = move.to();
+        MoveFlags flags = move.flags();
+        Piece moving = position.at(from);
+        // surge generates castling from a FEN whose castling rights don't
+        // match the board, e.g. benchmark position 5. Such a move from an
+        // empty square changes nothing here.
+        if (moving == NO_PIECE) {
+            return;
+        }
+        state.score -= psq[moving][from];
+
+        if (flags & CAPTURE) {
+            Square capturedSquare = flags == EN_PASSANT ? to + relative_dir<Us>(SOUTH) : to;
+            Piece captured = position.at(capturedSquare);
+            state.score -= psq[captured][capturedSquare];
+            state.gamePhase -= gamePhaseIncrement[captured];
+        }
+
+        if (flags & PR_KNIGHT) {
+            Piece promoted = make_piece(Us, PieceType(KNIGHT + (flags & 0b11)));
+            state.score += psq[promoted][to];
+            state.gamePhase += gamePhaseIncrement[promoted];
+        } else {
+            state.score += psq[moving][to];
+        }
+
+        if (flags == OO || flags == OOO) {
+            Piece rook = make_piece(Us, ROOK);
+            Square rookFrom = flags == OO ? (Us == WHITE ? h1 : h8) : (Us == WHITE ? a1 : a8);
+            Square rookTo = flags == OO ? (Us == WHITE ? f1 : f8) : (Us == WHITE ? d1 : d8);
+            state.score += psq[rook][rookTo] - psq[rook][rookFrom];
+        }
+    }
+
+    // Tapered evaluation from Us's point of view: interpolates between the
+    // middlegame and endgame scores by the remaining material. With
+    // DEBUG_EVAL the state is checked against a full recompute first.
+    template<Color Us>
+    int evaluate(const PsqtState& state, [[maybe_unused]] const Position& position) const {
+#ifdef DEBUG_EVAL
+        PsqtState expected = computeState(position);
+        if (expected.score != state.score || expected.gamePhase != state.gamePhase) {
+            std::cerr << "Incremental evaluation mismatch in " << position.fen() << std::endl;
+            std::abort();
+        }
+#endif
+        int midgamePhase = std::min(state.gamePhase, MAX_GAME_PHASE);
+        int endgamePhase = MAX_GAME_PHASE - midgamePhase;
+        int evaluation = (midgamePhase * midgameValue(state.score) + endgamePhase * endgameValue(state.score)) / MAX_GAME_PHASE;
+        if constexpr (Us == BLACK) {
+            return -evaluation;
+        }
+        return evaluation;
+    }
 
     int midgamePst[14][64] = {
         // White Pawn
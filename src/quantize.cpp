@@ -0,0 +1,133 @@
+#include "nn/bitboard.h"
+#include "nn/position.h"
+#include "nn/nnue/nnue_accumulator.h"
+#include "nn/nnue/nnue_architecture.h"
+#include "nn/nnue/nnue_dispatch.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Quantises the feature transformer weights of a net to int8 (see
+// NNUE_INT8_WEIGHTS in nn/nnue/nnue_feature_transformer.h) and reports how
+// far the int8 evaluations are from the int16 ones.
+//
+// Usage: quantize <net.nnue> <fens>
+//
+// The net is read through load_eval by both the int16 and the int8 build of
+// the NNUE code for one instruction set (QUANTIZE_ARCH in the Makefile), and
+// every position of the FEN file, one per line, is evaluated by both. The
+// quantised net is then written next to the net as the pre-decoded file that
+// the int8 engine builds (make NNUE_WEIGHTS=int8) map instead of decoding it.
+
+using namespace Stockfish;
+using namespace Stockfish::Eval::NNUE;
+
+namespace Stockfish::Eval::NNUE {
+namespace NNUE_ISA {
+extern const Kernels ArchKernels;
+}
+namespace NNUE_INT8_ARCH(NNUE_ISA) {
+extern const Kernels ArchKernels;
+}
+}
+
+static const Kernels& reference = NNUE_ISA::ArchKernels;
+static const Kernels& quantised = NNUE_INT8_ARCH(NNUE_ISA)::ArchKernels;
+
+// Loads the net with the given kernels as the smallest net size that takes
+// its width
+static std::optional<std::string> load(const Kernels& kernels, const std::string& path, NetSize& netSize) {
+    for (NetSize size : {Small, Big}) {
+        std::ifstream stream(path, std::ios::binary);
+        std::optional<std::string> description = kernels.load_eval(stream, size);
+        if (description.has_value()) {
+            netSize = size;
+            return description;
+        }
+    }
+    return std::nullopt;
+}
+
+static std::vector<Value> evaluate(const Kernels& kernels, NetSize netSize,
+                                   const std::vector<const Position*>& positions) {
+    auto stack = std::make_unique<AccumulatorStack>();
+    auto caches = std::make_unique<AccumulatorCaches>();
+    std::vector<Value> values(positions.size());
+
+    stack->reset();
+    (netSize == Small ? kernels.evaluate_batch_small : kernels.evaluate_batch_big)(
+        positions.data(), positions.size(), *stack, *caches, false, values.data(), nullptr);
+    return values;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <net.nnue> <fens>\n", argv[0]);
+        return 1;
+    }
+    const std::string netPath = argv[1];
+
+    Bitboards::init();
+
+    std::ifstream fenFile(argv[2]);
+    std::vector<std::string> fens;
+    for (std::string line; std::getline(fenFile, line);)
+        if (!line.empty())
+            fens.push_back(line);
+
+    std::vector<Position> positions(fens.size());
+    std::vector<StateInfo> states(fens.size());
+    std::vector<const Position*> pointers(fens.size());
+    for (size_t i = 0; i < fens.size(); ++i) {
+        positions[i].set(fens[i], &states[i]);
+        pointers[i] = &positions[i];
+    }
+
+    NetSize netSize;
+    std::optional<std::string> description = load(reference, netPath, netSize);
+    if (!description.has_value() || !load(quantised, netPath, netSize).has_value()) {
+        std::fprintf(stderr, "Failed to load %s\n", netPath.c_str());
+        return 1;
+    }
+
+    const std::vector<Value> expected = evaluate(reference, netSize, pointers);
+    const std::vector<Value> actual = evaluate(quantised, netSize, pointers);
+
+    size_t identical = 0, large = 0;
+    long long totalError = 0;
+    int maxError = 0;
+    for (size_t i = 0; i < fens.size(); ++i) {
+        int error = std::abs(actual[i] - expected[i]);
+        identical += error == 0;
+        large += error > 16;
+        totalError += error;
+        maxError = std::max(maxError, error);
+    }
+    const double n = std::max<size_t>(fens.size(), 1);
+
+    std::printf("Net: %s (%s)\n", netPath.c_str(), netSize == Small ? "small" : "big");
+    std::printf("Kernels: %s against %s\n", quantised.name, reference.name);
+    std::printf("Positions: %zu\n", fens.size());
+    std::printf("Identical evaluations: %.1f%%\n", 100 * identical / n);
+    std::printf("Mean absolute error: %.2f\n", totalError / n);
+    std::printf("Maximum absolute error: %d\n", maxError);
+    std::printf("Errors above 16: %.2f%%\n", 100 * large / n);
+
+    const std::string mappedPath = netPath + "." + quantised.tag + ".map";
+    if (!quantised.save_mapped_eval(mappedPath, netSize, description.value())) {
+        std::fprintf(stderr, "Failed to write %s\n", mappedPath.c_str());
+        return 1;
+    }
+    std::printf("Written: %s (%ju bytes)\n", mappedPath.c_str(),
+                std::uintmax_t(std::filesystem::file_size(mappedPath)));
+
+    return 0;
+}
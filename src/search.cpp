@@ -4,7 +4,11 @@ template <Color Us>
 int Search::negamax(int ply, int depth) {
     ++nodesSearched;
     if (depth == 0) {
+#ifdef USE_NNUE
+        return evaluator.nnueevaluate<Us>(position);
+#else
         return evaluator.evaluate<Us>(position);
+#endif
         //        return Evaluation::evaluate<Us>(position);
     }
     int max = -64000;
@@ -16,10 +20,13 @@ int Search::negamax(int ply, int depth) {
             return 0;
         }
     }
+    PsqtState psqtState = evaluator.getState();
     for (Move move : legalMoves) {
+        evaluator.update<Us>(position, move);
         position.play<Us>(move);
         int score = -negamax<~Us>(ply + 1, depth - 1);
         position.undo<Us>(move);
+        evaluator.undo(psqtState);
         if (score > max) {
             max = score;
             if (ply == 0) {
@@ -34,6 +41,7 @@ template <Color Us>
 SearchResult Search::search() {
     nodesSearched = 0;
     int depth = 5;
+    evaluator.refresh(position);
     auto begin = chrono::steady_clock::now();
     int eval = negamax<Us>(0, depth);
     auto end = chrono::steady_clock::now();
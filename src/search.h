@@ -7,6 +7,7 @@ using namespace std;
 #include "surge/types.h"
 
 #include "evaluation.h"
+#include "castling.h"
 
 #include <chrono>
 